@@ -0,0 +1,8 @@
+// Copyright (c) 2016, XMOS Ltd, All rights reserved
+#ifndef __xtcp_conf_h__
+#define __xtcp_conf_h__
+
+// Receive the port 9000 echo data via the shared-memory receive path
+#define XTCP_ENABLE_SHARED_RECV 1
+
+#endif // __xtcp_conf_h__
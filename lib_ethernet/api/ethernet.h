@@ -30,6 +30,14 @@ typedef enum ethernet_link_state_t {
   ETHERNET_LINK_UP       /**< Ethernet link up event. */
 } ethernet_link_state_t;
 
+/** Type representing the 802.1Qav stream reservation classes that the
+ *  high priority transmit traffic is shaped in */
+typedef enum ethernet_qav_class_t {
+  ETHERNET_QAV_CLASS_A,     /**< SR class A, 125 us observation interval */
+  ETHERNET_QAV_CLASS_B,     /**< SR class B, 250 us observation interval */
+  ETHERNET_QAV_NUM_CLASSES  /**< Count of classes in this enum */
+} ethernet_qav_class_t;
+
 /** Structure representing a received data or control packet from the Ethernet MAC */
 typedef struct ethernet_packet_info_t {
   eth_packet_type_t type; /**< Type representing the type of packet from the MAC */
@@ -37,8 +45,20 @@ typedef struct ethernet_packet_info_t {
   unsigned timestamp;     /**< The local time the packet was received by the MAC */
   unsigned src_ifnum;     /**< The index of the MAC interface that received the packet */
   unsigned filter_data;   /**< A word of user data that was registered with the MAC address filter */
+  unsigned checksum_status; /**< The checksums that the MAC verified, a combination of
+                                 ``ETHERNET_RX_IP_CHECKSUM_OK`` and ``ETHERNET_RX_L4_CHECKSUM_OK``.
+                                 Always 0 unless receive checksum offload is enabled */
 } ethernet_packet_info_t;
 
+/** The IPv4 header checksum of a received frame was verified by the MAC */
+#define ETHERNET_RX_IP_CHECKSUM_OK (1 << 0)
+/** The TCP or UDP checksum of a received frame was verified by the MAC */
+#define ETHERNET_RX_L4_CHECKSUM_OK (1 << 1)
+
+/** Internal flag that asks the MAC to fill in the checksums of a frame, see
+ *  send_packet_with_checksums() */
+#define ETHERNET_TX_INSERT_CHECKSUMS (1 << 1)
+
 /** Structure representing MAC address filter data that is registered with the Ethernet MAC */
 typedef struct ethernet_macaddr_filter_t {
   uint8_t addr[6];       /**< Six-octet destination MAC address to filter to the client that registers it */
@@ -53,6 +73,59 @@ typedef enum ethernet_macaddr_filter_result_t {
   ETHERNET_MACADDR_FILTER_TABLE_FULL  /**< The filter entry was not added because the filter table is full */
 } ethernet_macaddr_filter_result_t;
 
+/** Flags for the fields of a received frame that an RX rule matches */
+#define ETHERNET_RX_RULE_VLAN_ID   (1 << 0) /**< The VLAN ID of an 802.1Q tag */
+#define ETHERNET_RX_RULE_PCP       (1 << 1) /**< The priority code point of an 802.1Q tag */
+#define ETHERNET_RX_RULE_ETHERTYPE (1 << 2) /**< The ethertype, after any 802.1Q tag */
+#define ETHERNET_RX_RULE_IP_PROTO  (1 << 3) /**< The protocol of an IPv4 packet */
+#define ETHERNET_RX_RULE_L4_PORT   (1 << 4) /**< The destination port of a TCP or UDP segment */
+
+/** Structure representing a rule that steers received frames, registered with the Ethernet MAC */
+typedef struct ethernet_rx_rule_t {
+  unsigned fields;       /**< The fields that a frame must match, a combination of the
+                              ``ETHERNET_RX_RULE_*`` flags. A rule with no fields matches every frame */
+  uint16_t vlan_id;      /**< The 12-bit VLAN ID to match */
+  uint8_t pcp;           /**< The 3-bit priority code point to match */
+  uint8_t ip_proto;      /**< The IP protocol number to match */
+  uint16_t ethertype;    /**< The ethertype to match */
+  uint16_t l4_port;      /**< The TCP or UDP destination port to match. Only the first
+                              fragment of an IP packet has a port */
+  unsigned clients;      /**< Bitfield of the RX clients that a matching frame is sent to.
+                              A rule with no clients drops the frames it matches */
+  int is_hp;             /**< Queue a matching frame for the high priority client instead */
+} ethernet_rx_rule_t;
+
+/** Type representing the result of adding an RX rule to the Ethernet MAC */
+typedef enum ethernet_rx_rule_result_t {
+  ETHERNET_RX_RULE_SUCCESS,    /**< The rule was added successfully */
+  ETHERNET_RX_RULE_TABLE_FULL  /**< The rule was not added because the rule list is full */
+} ethernet_rx_rule_result_t;
+
+/** Structure of the statistics counters kept by the Ethernet MAC. The
+ *  counters are 32-bit and wrap.
+ */
+typedef struct ethernet_mac_stats_t {
+  unsigned rx_frames;                 /**< Frames received with a valid length and CRC */
+  unsigned rx_bytes;                  /**< Bytes in those frames, excluding the CRC */
+  unsigned rx_crc_errors;             /**< Frames dropped because of a bad CRC */
+  unsigned rx_length_errors;          /**< Frames dropped because they were too short or too long */
+  unsigned rx_filter_rejects;         /**< Frames not accepted by any client's filters */
+  unsigned rx_no_buffer_drops;        /**< Frames dropped because no receive buffer was free */
+  unsigned rx_client_drops;           /**< Frames dropped because a client's queue was full */
+  unsigned rx_hp_frames;              /**< Frames queued for the high priority client */
+  unsigned rx_lp_frames;              /**< Frames queued for low priority clients */
+  unsigned rx_free_buffers_low_water; /**< The fewest receive buffers that have been free,
+                                           or ~0 if the MAC does not track it */
+  unsigned tx_frames;                 /**< Frames transmitted */
+  unsigned tx_bytes;                  /**< Bytes in those frames, excluding the CRC */
+  unsigned tx_hp_frames;              /**< Frames transmitted from the high priority queue */
+  unsigned rx_classify_overruns;      /**< Frames that took longer to classify and
+                                           checksum than the minimum frame time at
+                                           1 Gb/s allows */
+  unsigned tx_hp_b_drops;             /**< SR class B frames dropped because every class B
+                                           transmit buffer was full */
+} ethernet_mac_stats_t;
+
 #ifdef __XC__
 
 /** Ethernet MAC configuration interface.
@@ -145,6 +218,38 @@ typedef interface ethernet_cfg_if {
    */
   void del_ethertype_filter(size_t client_num, uint16_t ethertype);
 
+  /** Add a rule that steers received frames by their VLAN tag, ethertype,
+   *  IP protocol or destination port.
+   *
+   *  Rules are applied to frames that pass the MAC address filter. They are
+   *  tried in order of priority, and the first rule that a frame matches
+   *  decides which clients it is sent to and in which queue, in place of
+   *  the Ethertype filters. Frames that match no rule are filtered as usual.
+   *  At most ``ETHERNET_RX_RULES_MAX`` rules can be added.
+   *  This function is only available in the 10/100/1000 Mb/s MAC.
+   *
+   *  \param priority     The priority of the rule, lowest first. Rules of the same
+   *                      priority are tried in the order that they were added.
+   *  \param rule         The rule to add.
+   *
+   *  \returns            ETHERNET_RX_RULE_SUCCESS when the rule is added or
+   *                      ETHERNET_RX_RULE_TABLE_FULL on failure.
+   */
+  ethernet_rx_rule_result_t add_rx_rule(unsigned priority, ethernet_rx_rule_t rule);
+
+  /** Delete an RX rule.
+   *  This function is only available in the 10/100/1000 Mb/s MAC.
+   *
+   *  \param priority     The priority that the rule was added with.
+   *  \param rule         The rule to delete.
+   */
+  void del_rx_rule(unsigned priority, ethernet_rx_rule_t rule);
+
+  /** Delete all RX rules.
+   *  This function is only available in the 10/100/1000 Mb/s MAC.
+   */
+  void del_all_rx_rules();
+
   /** Get the tile ID that the Ethernet MAC is running on and the current timer value on that tile.
    *  This function is only available in the 10/100 Mb/s real-time and 10/100/1000 Mb/s MACs.
    *
@@ -154,6 +259,8 @@ typedef interface ethernet_cfg_if {
   void get_tile_id_and_timer_value(unsigned &tile_id, unsigned &time_on_tile);
 
   /** Set the high-priority TX queue's credit based shaper idle slope.
+   *  This sets the slope of SR class A, the class that
+   *  ethernet_send_hp_packet() sends in.
    *  This function is only available in the 10/100 Mb/s real-time and 10/100/1000 Mb/s MACs.
    *
    *  \param ifnum   The index of the MAC interface to set the slope
@@ -161,6 +268,35 @@ typedef interface ethernet_cfg_if {
    */
   void set_egress_qav_idle_slope(size_t ifnum, unsigned slope);
 
+  /** Set the credit based shaper idle slope of one SR class of the
+   *  high-priority TX traffic. Each class has its own queue and credit.
+   *  This function is only available in the 10/100 Mb/s real-time and 10/100/1000 Mb/s MACs.
+   *  Class B is only shaped separately when ``ETHERNET_SUPPORT_TRAFFIC_SHAPER_CLASS_B``
+   *  is set, otherwise its slope is ignored.
+   *
+   *  \param ifnum     The index of the MAC interface to set the slope
+   *  \param qav_class The SR class to set the slope of
+   *  \param slope     The slope value, in bits per 10 ns timer tick
+   *                   with 16 fractional bits
+   */
+  void set_egress_qav_class_idle_slope(size_t ifnum, ethernet_qav_class_t qav_class,
+                                       unsigned slope);
+
+  /** Set the limits that the credit of one SR class is kept between,
+   *  the hiCredit and loCredit of 802.1Qav. By default the credit is
+   *  not limited.
+   *  This function is only available in the 10/100 Mb/s real-time and 10/100/1000 Mb/s MACs.
+   *
+   *  \param ifnum     The index of the MAC interface to set the limits
+   *  \param qav_class The SR class to set the limits of
+   *  \param hi_credit The most credit the class can build up while it is
+   *                   blocked by other traffic, in bits
+   *  \param lo_credit The lowest the credit can fall after sending, in bits.
+   *                   Must be zero or negative
+   */
+  void set_egress_qav_class_credit_limits(size_t ifnum, ethernet_qav_class_t qav_class,
+                                          int hi_credit, int lo_credit);
+
   /** Set the ingress latency to correct for the offset between the timestamp
    *  measurement plane relative to the reference plane. See 802.1AS 8.4.3.
    *
@@ -211,6 +347,25 @@ typedef interface ethernet_cfg_if {
    */
   void disable_strip_vlan_tag(size_t client_num);
 
+  /** Get the statistics counters of the Ethernet MAC.
+   *
+   *  Counters which a MAC cannot observe are left at 0. Only the
+   *  10/100/1000 Mb/s MAC can count frames dropped for lack of a buffer.
+   *
+   *  \param ifnum   The index of the MAC interface to get the counters of
+   *  \param stats   Structure filled in with the current counter values
+   */
+  void get_stats(size_t ifnum, ethernet_mac_stats_t &stats);
+
+  /** Get the number of frames that were dropped because a client's receive
+   *  queue was full.
+   *
+   *  \param client_num   The index into the set of RX clients. Can be acquired by
+   *                      calling the get_index() method.
+   *  \returns            The number of frames dropped for that client
+   */
+  unsigned get_rx_client_drops(size_t client_num);
+
 } ethernet_cfg_if;
 
 /** Ethernet MAC data transmit interface
@@ -244,6 +399,24 @@ extends client interface ethernet_tx_if : {
     i._complete_send_packet(packet, n, 0, ifnum);
   }
 
+  /** Function to send an Ethernet packet on the specified interface, with the
+   *  MAC filling in the IPv4 header checksum and the TCP or UDP checksum.
+   *
+   *  The checksum fields of the packet are ignored. Other packets are sent
+   *  unchanged.
+   *
+   *  \param packet       A byte-array containing the Ethernet packet to send.
+   *                      Must include a valid Ethernet frame header.
+   *  \param n            The number of bytes in the packet array to send
+   *  \param ifnum        The index of the MAC interface to send the packet
+   *                      Use the ``ETHERNET_ALL_INTERFACES`` define to send to all interfaces.
+   */
+  inline void send_packet_with_checksums(client ethernet_tx_if i, char packet[n],
+                                         unsigned n, unsigned ifnum) {
+    i._init_send_packet(n, ifnum);
+    i._complete_send_packet(packet, n, ETHERNET_TX_INSERT_CHECKSUMS, ifnum);
+  }
+
   /** Function to send an Ethernet packet on the specified interface and return a timestamp
    *  when the packet was sent by the MAC.
    *
@@ -304,6 +477,28 @@ typedef interface ethernet_rx_if {
   [[clears_notification]] void get_packet(ethernet_packet_info_t &desc,
                                           char packet[n],
                                           unsigned n);
+
+  /** Function to borrow a received packet from the MAC rather than have it
+   *  copied. Can be called after a packet_ready() notification instead of
+   *  get_packet(), by a client on the same tile as the MAC.
+   *
+   *  The packet stays in the MAC's buffer until the client hands it back
+   *  with release_packet(). A client can borrow one packet at a time, and
+   *  may modify it in place: a packet that other clients have still to be
+   *  sent is lent from a copy.
+   *
+   *  \param desc       A descriptor containing metadata about the packet contents.
+   *
+   *  \returns          A pointer to the packet data, or null if the
+   *                    descriptor type is ``ETH_NO_DATA``.
+   */
+  [[clears_notification]] char * unsafe borrow_packet(ethernet_packet_info_t &desc);
+
+  /** Function to hand a packet borrowed with borrow_packet() back to the MAC.
+   *
+   *  \param data       The pointer returned by borrow_packet().
+   */
+  void release_packet(char * unsafe data);
 } ethernet_rx_if;
 
 /** Function to receive a priority-queued packet over a high priority channel
@@ -352,6 +547,34 @@ inline void ethernet_send_hp_packet(streaming chanend c_tx_hp,
   sout_char_array(c_tx_hp, packet, n);
 }
 
+/** Function to send a priority-queued packet in a given SR class over a
+ *  high priority channel.
+ *
+ *  Each class is queued and shaped separately, so class B packets that are
+ *  waiting for credit do not hold up class A packets. A class B packet sent
+ *  while every class B buffer is full is dropped rather than left blocking
+ *  the channel, and counted in the ``tx_hp_b_drops`` statistic. A class A
+ *  packet sent while every class A buffer is full waits for one.
+ *
+ *  \param c_tx_hp     A streaming channel end connected to the MAC.
+ *  \param packet      A byte-array containing the Ethernet packet to send.
+ *                     Must include a valid Ethernet frame header.
+ *  \param n           The number of bytes in the packet array to send
+ *  \param ifnum       The index of the MAC interface to send the packet
+ *                     Use the ``ETHERNET_ALL_INTERFACES`` define to send to all interfaces.
+ *  \param qav_class   The SR class to queue the packet in
+ */
+inline void ethernet_send_hp_packet_class(streaming chanend c_tx_hp,
+                                          char packet[n],
+                                          unsigned n,
+                                          unsigned ifnum,
+                                          ethernet_qav_class_t qav_class)
+{
+  // The class is carried in the upper half of the length word
+  c_tx_hp <: n | (qav_class << 16);
+  sout_char_array(c_tx_hp, packet, n);
+}
+
 /** Enum representing a flag to enable or disable the 802.1Qav credit based traffic shaper
  *  on the egress MAC port.
  */
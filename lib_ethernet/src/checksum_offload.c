@@ -0,0 +1,154 @@
+// Copyright (c) 2016, XMOS Ltd, All rights reserved
+#include <stdint.h>
+#include "checksum_offload.h"
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_VLAN 0x8100
+#define IP_PROTO_TCP   6
+#define IP_PROTO_UDP   17
+
+// The ones' complement sum is independent of byte order, so the data is
+// summed as little-endian halfwords and only the values mixed in from
+// elsewhere need swapping. The folded sum is then in memory byte order.
+static inline unsigned swap16(unsigned x)
+{
+  return ((x & 0xff) << 8) | ((x >> 8) & 0xff);
+}
+
+static unsigned sum16(const uint8_t *p, unsigned len, unsigned sum)
+{
+  if (((uintptr_t)p & 1) == 0) {
+    const uint16_t *q = (const uint16_t *)p;
+    for (; len >= 2; len -= 2)
+      sum += *q++;
+    p = (const uint8_t *)q;
+  }
+  else {
+    for (; len >= 2; len -= 2, p += 2)
+      sum += p[0] | (p[1] << 8);
+  }
+  if (len)
+    sum += p[0];
+  return sum;
+}
+
+static inline unsigned fold(unsigned sum)
+{
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return sum;
+}
+
+typedef struct ipv4_frame_t {
+  const uint8_t *ip;    // The IPv4 header
+  unsigned ip_len;      // Its length in bytes
+  const uint8_t *l4;    // The TCP or UDP header, or 0 if not checked
+  unsigned l4_len;      // The length of the segment or datagram
+  unsigned l4_csum;     // The offset of its checksum field
+} ipv4_frame_t;
+
+// Find the parts of an IPv4 frame that carry checksums. Returns 0 if the
+// frame is not IPv4 or is malformed.
+static int parse(const uint8_t *frame, unsigned len, ipv4_frame_t *f)
+{
+  unsigned l2_len = 14;
+  if (len < l2_len + 20)
+    return 0;
+  unsigned ethertype = (frame[12] << 8) | frame[13];
+  if (ethertype == ETHERTYPE_VLAN) {
+    l2_len += 4;
+    ethertype = (frame[16] << 8) | frame[17];
+  }
+  if (ethertype != ETHERTYPE_IPV4)
+    return 0;
+
+  const uint8_t *ip = frame + l2_len;
+  unsigned ip_len = (ip[0] & 0xf) << 2;
+  unsigned total_len = (ip[2] << 8) | ip[3];
+  if ((ip[0] >> 4) != 4 || ip_len < 20 || total_len < ip_len ||
+      l2_len + total_len > len)
+    return 0;
+
+  f->ip = ip;
+  f->ip_len = ip_len;
+  f->l4 = 0;
+
+  // Fragments cannot be checked on their own
+  if (((ip[6] & 0x3f) | ip[7]) != 0)
+    return 1;
+
+  unsigned l4_len = total_len - ip_len;
+  if (ip[9] == IP_PROTO_TCP && l4_len >= 20)
+    f->l4_csum = 16;
+  else if (ip[9] == IP_PROTO_UDP && l4_len >= 8)
+    f->l4_csum = 6;
+  else
+    return 1;
+
+  f->l4 = ip + ip_len;
+  f->l4_len = l4_len;
+  return 1;
+}
+
+static unsigned pseudo_header_sum(const ipv4_frame_t *f)
+{
+  unsigned sum = sum16(f->ip + 12, 8, 0);
+  return sum + swap16(f->ip[9]) + swap16(f->l4_len);
+}
+
+unsigned ethernet_rx_checksum_status(const char *frame, unsigned len)
+{
+  ipv4_frame_t f;
+  if (!parse((const uint8_t *)frame, len, &f))
+    return 0;
+
+  unsigned status = 0;
+  if (fold(sum16(f.ip, f.ip_len, 0)) == 0xffff)
+    status |= ETHERNET_RX_IP_CHECKSUM_OK;
+
+  if (f.l4) {
+    // A UDP checksum of zero means the sender did not compute one
+    if (f.ip[9] == IP_PROTO_UDP && f.l4[6] == 0 && f.l4[7] == 0)
+      status |= ETHERNET_RX_L4_CHECKSUM_OK;
+    else if (fold(sum16(f.l4, f.l4_len, pseudo_header_sum(&f))) == 0xffff)
+      status |= ETHERNET_RX_L4_CHECKSUM_OK;
+  }
+  return status;
+}
+
+unsigned ethernet_tx_checksums(const char *frame, unsigned len,
+                               unsigned offsets[2], unsigned values[2])
+{
+  ipv4_frame_t f;
+  if (!parse((const uint8_t *)frame, len, &f))
+    return 0;
+
+  // Sum around the checksum fields rather than clearing them first
+  unsigned sum = sum16(f.ip, 10, 0);
+  sum = sum16(f.ip + 12, f.ip_len - 12, sum);
+  offsets[0] = (f.ip - (const uint8_t *)frame) + 10;
+  values[0] = ~fold(sum) & 0xffff;
+
+  if (!f.l4)
+    return 1;
+
+  sum = sum16(f.l4, f.l4_csum, pseudo_header_sum(&f));
+  sum = sum16(f.l4 + f.l4_csum + 2, f.l4_len - f.l4_csum - 2, sum);
+  unsigned csum = ~fold(sum) & 0xffff;
+  // A computed UDP checksum of zero is sent as all ones
+  if (csum == 0 && f.ip[9] == IP_PROTO_UDP)
+    csum = 0xffff;
+  offsets[1] = (f.l4 - (const uint8_t *)frame) + f.l4_csum;
+  values[1] = csum;
+  return 2;
+}
+
+void ethernet_insert_checksums(char *frame, unsigned len)
+{
+  unsigned offsets[2], values[2];
+  unsigned n = ethernet_tx_checksums(frame, len, offsets, values);
+  for (unsigned i = 0; i < n; i++) {
+    frame[offsets[i]] = values[i];
+    frame[offsets[i] + 1] = values[i] >> 8;
+  }
+}
@@ -0,0 +1,34 @@
+// Copyright (c) 2016, XMOS Ltd, All rights reserved
+#ifndef __checksum_offload_h__
+#define __checksum_offload_h__
+
+#include "ethernet.h"
+
+#ifdef __XC__
+extern "C" {
+#endif
+
+/** Verify the IPv4 header checksum and the TCP or UDP checksum of a received
+ *  frame. Returns a combination of ETHERNET_RX_IP_CHECKSUM_OK and
+ *  ETHERNET_RX_L4_CHECKSUM_OK; a checksum which is wrong or is not checked,
+ *  such as that of an IP fragment, leaves its bit clear.
+ */
+unsigned ethernet_rx_checksum_status(const char *frame, unsigned len);
+
+/** Compute the IPv4 header checksum and the TCP or UDP checksum of a frame
+ *  to be sent. The checksum fields themselves are ignored. Returns the
+ *  number of checksums found, with the byte offset of each checksum field
+ *  in \p offsets and the value to store there in \p values. The values are
+ *  in memory byte order, so are stored low byte first.
+ */
+unsigned ethernet_tx_checksums(const char *frame, unsigned len,
+                               unsigned offsets[2], unsigned values[2]);
+
+/** Fill in the checksums of a frame to be sent, in place. */
+void ethernet_insert_checksums(char *frame, unsigned len);
+
+#ifdef __XC__
+}
+#endif
+
+#endif // __checksum_offload_h__
@@ -30,6 +30,9 @@ typedef struct
   size_t num_etype_filters;
   int strip_vlan_tags;
   uint16_t etype_filters[ETHERNET_MAX_ETHERTYPE_FILTERS];
+  void *loan;                //!< The buffer lent to the client, or null
+  unsigned loan_index;       //!< Its index in the MAC's packet queue
+  char status_data[2];       //!< Link status lent to the client
 } rx_client_state_t;
 
 // Data structure to keep track of link layer status for transmit clients.
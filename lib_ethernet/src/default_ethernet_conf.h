@@ -14,6 +14,13 @@
 #define ETHERNET_SUPPORT_TRAFFIC_SHAPER (0)
 #endif
 
+// Queue and shape SR class B high priority traffic separately from class A.
+// In the 10/100 Mb/s real-time MAC this splits the high priority transmit
+// buffer between the two classes.
+#ifndef ETHERNET_SUPPORT_TRAFFIC_SHAPER_CLASS_B
+#define ETHERNET_SUPPORT_TRAFFIC_SHAPER_CLASS_B (0)
+#endif
+
 #ifndef ETHERNET_FILTER_SPECIALIZATION
   #define ETHERNET_FILTER_SPECIALIZATION
   #ifndef ETHERNET_ENABLE_FILTER_TIMING
@@ -70,6 +77,22 @@
 #define ETHERNET_MAX_ETHERTYPE_FILTERS 2
 #endif
 
+#ifndef ETHERNET_RX_CHECKSUM_OFFLOAD
+// Verify the IPv4, TCP and UDP checksums of received frames in the filter
+#define ETHERNET_RX_CHECKSUM_OFFLOAD 0
+#endif
+
+#ifndef RX_CLASSIFIER_TABLE_SIZE
+// Keep this as a power of 2 as it is used to mask the hash
+#define RX_CLASSIFIER_TABLE_SIZE 16
+#endif
+
+#ifndef ETHERNET_RX_RULES_MAX
+// Every rule is tried in turn until one matches, so each one adds to the
+// time that the filter takes per frame
+#define ETHERNET_RX_RULES_MAX 8
+#endif
+
 #ifndef __SIMULATOR__
 #define __SIMULATOR__ 0
 #endif
@@ -34,6 +34,8 @@ void mii_macaddr_hash_table_init()
 {
   clear_table(hash_table);
   clear_table(backup_table);
+  rx_classifier_init(&hash_table->classifier);
+  rx_classifier_init(&backup_table->classifier);
 }
 
 void mii_macaddr_set_num_active_filters(unsigned num_active)
@@ -351,3 +353,48 @@ void mii_macaddr_hash_table_clear()
   // Apply clear operation to new backup table (quicker than copying a blank table)
   clear_table(backup_table);
 }
+
+// The ethertype classifier shares the tables so that the filter threads pick
+// up both with a single pointer. Updates are deterministic, so applying them
+// to each table in turn keeps the two in sync.
+int mii_macaddr_hash_table_add_ethertype(unsigned client_num, uint16_t ethertype)
+{
+  if (!rx_classifier_add(&backup_table->classifier, client_num, ethertype))
+    return 0;
+
+  swap_tables(0);
+  rx_classifier_add(&backup_table->classifier, client_num, ethertype);
+  return 1;
+}
+
+void mii_macaddr_hash_table_del_ethertype(unsigned client_num, uint16_t ethertype,
+                                          int still_filtered)
+{
+  rx_classifier_del(&backup_table->classifier, client_num, ethertype, still_filtered);
+  swap_tables(0);
+  rx_classifier_del(&backup_table->classifier, client_num, ethertype, still_filtered);
+}
+
+int mii_macaddr_hash_table_add_rx_rule(unsigned priority, ethernet_rx_rule_t rule)
+{
+  if (!rx_classifier_add_rule(&backup_table->classifier, priority, &rule))
+    return 0;
+
+  swap_tables(0);
+  rx_classifier_add_rule(&backup_table->classifier, priority, &rule);
+  return 1;
+}
+
+void mii_macaddr_hash_table_del_rx_rule(unsigned priority, ethernet_rx_rule_t rule)
+{
+  rx_classifier_del_rule(&backup_table->classifier, priority, &rule);
+  swap_tables(0);
+  rx_classifier_del_rule(&backup_table->classifier, priority, &rule);
+}
+
+void mii_macaddr_hash_table_clear_rx_rules()
+{
+  rx_classifier_clear_rules(&backup_table->classifier);
+  swap_tables(0);
+  rx_classifier_clear_rules(&backup_table->classifier);
+}
@@ -4,6 +4,7 @@
 
 #include "default_ethernet_conf.h"
 #include "macaddr_filter.h"
+#include "rx_classifier.h"
 
 #ifdef __XC__
 extern "C" {
@@ -21,6 +22,7 @@ typedef struct mii_macaddr_hash_table_t
   unsigned polys[2];
   unsigned num_entries;
   mii_macaddr_hash_table_entry_t entries[MII_MACADDR_HASH_TABLE_SIZE];
+  rx_classifier_t classifier;
 } mii_macaddr_hash_table_t;
   
 
@@ -42,6 +44,14 @@ void mii_macaddr_hash_table_delete_entry(unsigned client_num, int is_hp,
                                          ethernet_macaddr_filter_t entry);
 void mii_macaddr_hash_table_clear();
 
+int mii_macaddr_hash_table_add_ethertype(unsigned client_num, uint16_t ethertype);
+void mii_macaddr_hash_table_del_ethertype(unsigned client_num, uint16_t ethertype,
+                                          int still_filtered);
+
+int mii_macaddr_hash_table_add_rx_rule(unsigned priority, ethernet_rx_rule_t rule);
+void mii_macaddr_hash_table_del_rx_rule(unsigned priority, ethernet_rx_rule_t rule);
+void mii_macaddr_hash_table_clear_rx_rules();
+
 #ifdef __XC__
 }
 #endif
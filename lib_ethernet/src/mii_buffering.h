@@ -43,6 +43,7 @@ typedef struct mii_packet_t {
                         //   to other ports
   int vlan_tagged;      //!< Whether the packet is VLAN tagged or not
   unsigned filter_data; //!< Word of data returned by the mac filter
+  unsigned checksum_status; //!< The checksums verified by the filter
   unsigned int data[(MII_PACKET_DATA_BYTES+3)/4];
 } mii_packet_t;
 
@@ -3,7 +3,7 @@
 #define __mii_buffering_defines_h__
 
 // The number of bytes in the mii_packet_t before the data
-#define MII_PACKET_HEADER_BYTES 40
+#define MII_PACKET_HEADER_BYTES 44
 #define MII_PACKET_HEADER_WORDS (MII_PACKET_HEADER_BYTES / 4)
 
 // The amount of space required for the common interrupt handler
@@ -5,14 +5,17 @@
 #include "default_ethernet_conf.h"
 #include "macaddr_filter.h"
 #include "mii_buffering.h"
+#include "server_state.h"
 
 #ifdef __XC__
 
 unsafe void mii_ethernet_filter(streaming chanend c,
                                 chanend c_conf,
+                                mii_mempool_t rx_mem,
                                 mii_packet_queue_t incoming_packets,
                                 mii_packet_queue_t rx_packets_lp,
-                                mii_packet_queue_t rx_packets_hp);
+                                mii_packet_queue_t rx_packets_hp,
+                                volatile ethernet_port_state_t * unsafe p_port_state);
 
 #endif
 
@@ -23,8 +23,10 @@ unsafe void mii_master_rx_pins(mii_mempool_t rx_mem,
 
 unsafe void mii_master_tx_pins(mii_mempool_t tx_mem_lp,
                                mii_mempool_t tx_mem_hp,
+                               mii_mempool_t tx_mem_hp_b,
                                mii_packet_queue_t hp_packets,
                                mii_packet_queue_t lp_packets,
+                               mii_packet_queue_t hp_packets_b,
                                mii_ts_queue_t ts_queue_lp,
                                out buffered port:32 p_mii_txd,
                                volatile ethernet_port_state_t * unsafe p_port_state);
@@ -31,6 +31,10 @@ void rgmii_tx_lld(streaming chanend c,
                   out buffered port:32 p_txd,
                   streaming chanend c_speed_change);
 
+// Receive error counts kept by the receivers, see rgmii_rx_lld.S
+extern unsigned mii_count_crc_error;
+extern unsigned mii_count_len_error;
+
 #endif
 
 #endif
@@ -13,6 +13,9 @@
 
 void rgmii_init_lock();
 
+// SR class B only has transmit buffers of its own when it is shaped separately
+#define RGMII_MAC_BUFFER_COUNT_TX_HP_B (ETHERNET_SUPPORT_TRAFFIC_SHAPER_CLASS_B ? RGMII_MAC_BUFFER_COUNT_TX : 1)
+
 #ifdef __XC__
 extern "C" {
 #endif
@@ -35,6 +38,9 @@ typedef struct buffers_used_t {
 void buffers_free_initialize(REFERENCE_PARAM(buffers_free_t, free), unsigned char *buffer,
                              unsigned *pointers, unsigned buffer_count);
 
+// Take a buffer out of a free pool, returning 0 if it was not there
+int buffers_free_remove(REFERENCE_PARAM(buffers_free_t, free), uintptr_t buffer);
+
 void buffers_used_initialize(REFERENCE_PARAM(buffers_used_t, used), unsigned *pointers);
 
 void empty_channel(streaming_chanend_t c);
@@ -45,7 +51,8 @@ unsafe void rgmii_buffer_manager(streaming chanend c_rx,
                                  buffers_used_t &used_buffers_rx_lp,
                                  buffers_used_t &used_buffers_rx_hp,
                                  buffers_free_t &free_buffers,
-                                 unsigned filter_num);
+                                 unsigned filter_num,
+                                 volatile ethernet_port_state_t * unsafe p_port_state);
 
 unsafe void rgmii_ethernet_rx_server(rx_client_state_t client_state_lp[n_rx_lp],
                                      server ethernet_rx_if i_rx_lp[n_rx_lp], unsigned n_rx_lp,
@@ -56,6 +63,7 @@ unsafe void rgmii_ethernet_rx_server(rx_client_state_t client_state_lp[n_rx_lp],
                                      buffers_used_t &used_buffers_rx_lp,
                                      buffers_used_t &used_buffers_rx_hp,
                                      buffers_free_t &free_buffers,
+                                     char * unsafe rx_copy,
                                      rgmii_inband_status_t &current_mode, int speed_change_ids[6],
                                      volatile ethernet_port_state_t * unsafe p_port_state);
 
@@ -67,7 +75,9 @@ unsafe void rgmii_ethernet_tx_server(tx_client_state_t client_state_lp[n_tx_lp],
                                      buffers_used_t &used_buffers_tx_lp,
                                      buffers_free_t &free_buffers_lp,
                                      buffers_used_t &used_buffers_tx_hp,
+                                     buffers_used_t &used_buffers_tx_hp_b,
                                      buffers_free_t &free_buffers_hp,
+                                     buffers_free_t &free_buffers_hp_b,
                                      volatile ethernet_port_state_t * unsafe p_port_state);
 #endif
 
@@ -26,4 +26,9 @@
 #define RGMII_DIVIDE RGMII_DIVIDE_100M
 #endif
 
-#define RGMII_ETHERNET_IFS_AS_REF_CLOCK_COUNT  ((96 + 96 - 10) * (RGMII_DIVIDE + 1)/2)
\ No newline at end of file
+#define RGMII_ETHERNET_IFS_AS_REF_CLOCK_COUNT  ((96 + 96 - 10) * (RGMII_DIVIDE + 1)/2)
+
+// The time in reference clock ticks that a filter thread has to classify a
+// frame, and check its checksums when that is enabled, at 1Gb/s. A minimum frame with its preamble and inter-frame gap is
+// 84 bytes, 672ns on the wire, and the two filter threads take turns.
+#define RGMII_RX_CLASSIFY_BUDGET_TICKS ((2 * 672) / 10)
@@ -0,0 +1,193 @@
+// Copyright (c) 2016, XMOS Ltd, All rights reserved
+#include <string.h>
+#include "rx_classifier.h"
+#include "macaddr_filter.h"
+
+extern unsigned rx_classifier_hash(unsigned ethertype);
+extern unsigned rx_classifier_lookup(const rx_classifier_t *c, const unsigned *data);
+
+void rx_classifier_init(rx_classifier_t *c)
+{
+  memset(c, 0, sizeof(*c));
+}
+
+static rx_classifier_entry_t *find(rx_classifier_t *c, unsigned ethertype)
+{
+  unsigned index = rx_classifier_hash(ethertype);
+  for (unsigned i = 0; i < c->max_probe; i++) {
+    if (c->entries[index].ethertype == ethertype)
+      return &c->entries[index];
+    if (c->entries[index].ethertype == 0)
+      break;
+    index = (index + 1) & (RX_CLASSIFIER_TABLE_SIZE - 1);
+  }
+  return 0;
+}
+
+static int insert(rx_classifier_t *c, unsigned ethertype, unsigned clients)
+{
+  if (c->num_entries == RX_CLASSIFIER_TABLE_SIZE)
+    return 0;
+
+  unsigned index = rx_classifier_hash(ethertype);
+  unsigned probe = 1;
+  while (c->entries[index].ethertype != 0) {
+    index = (index + 1) & (RX_CLASSIFIER_TABLE_SIZE - 1);
+    probe++;
+  }
+  c->entries[index].ethertype = ethertype;
+  c->entries[index].clients = clients;
+  c->num_entries++;
+  if (probe > c->max_probe)
+    c->max_probe = probe;
+  return 1;
+}
+
+// Entries no client uses any more are kept so that probe sequences stay
+// intact; when the table fills up it is rebuilt without them.
+static void compact(rx_classifier_t *c)
+{
+  rx_classifier_entry_t old[RX_CLASSIFIER_TABLE_SIZE];
+  memcpy(old, c->entries, sizeof(old));
+  memset(c->entries, 0, sizeof(c->entries));
+  c->num_entries = 0;
+  c->max_probe = 0;
+  for (unsigned i = 0; i < RX_CLASSIFIER_TABLE_SIZE; i++) {
+    if (old[i].clients)
+      insert(c, old[i].ethertype, old[i].clients);
+  }
+}
+
+int rx_classifier_add(rx_classifier_t *c, unsigned client_num, uint16_t ethertype)
+{
+  if (ethertype == 0)
+    return 0;
+
+  rx_classifier_entry_t *entry = find(c, ethertype);
+  if (entry) {
+    entry->clients |= 1 << client_num;
+  }
+  else {
+    if (c->num_entries == RX_CLASSIFIER_TABLE_SIZE)
+      compact(c);
+    if (!insert(c, ethertype, 1 << client_num))
+      return 0;
+  }
+  c->filtered_clients |= 1 << client_num;
+  return 1;
+}
+
+void rx_classifier_del(rx_classifier_t *c, unsigned client_num, uint16_t ethertype,
+                       int still_filtered)
+{
+  rx_classifier_entry_t *entry = find(c, ethertype);
+  if (entry)
+    entry->clients &= ~(1 << client_num);
+
+  if (!still_filtered)
+    c->filtered_clients &= ~(1 << client_num);
+}
+
+static void compile_rule(rx_classifier_rule_t *r, unsigned priority, const ethernet_rx_rule_t *rule)
+{
+  memset(r, 0, sizeof(*r));
+  r->priority = priority;
+  r->fields = rule->fields;
+  if (rule->fields & ETHERNET_RX_RULE_VLAN_ID)
+    r->tci_mask |= 0x0fff;
+  if (rule->fields & ETHERNET_RX_RULE_PCP)
+    r->tci_mask |= 0xe000;
+  r->tci = ((rule->pcp << 13) | rule->vlan_id) & r->tci_mask;
+  if (rule->fields & ETHERNET_RX_RULE_ETHERTYPE)
+    r->ethertype = rule->ethertype;
+  if (rule->fields & ETHERNET_RX_RULE_IP_PROTO)
+    r->ip_proto = rule->ip_proto;
+  if (rule->fields & ETHERNET_RX_RULE_L4_PORT)
+    r->l4_port = rule->l4_port;
+  if (rule->is_hp)
+    r->result = ethernet_filter_result_set_hp(1, 1);
+  else
+    r->result = ethernet_filter_result_interfaces(rule->clients);
+}
+
+int rx_classifier_add_rule(rx_classifier_t *c, unsigned priority, const ethernet_rx_rule_t *rule)
+{
+  if (c->num_rules == ETHERNET_RX_RULES_MAX)
+    return 0;
+
+  unsigned i = c->num_rules;
+  while (i > 0 && c->rules[i - 1].priority > priority) {
+    c->rules[i] = c->rules[i - 1];
+    i--;
+  }
+  compile_rule(&c->rules[i], priority, rule);
+  c->num_rules++;
+  return 1;
+}
+
+void rx_classifier_del_rule(rx_classifier_t *c, unsigned priority, const ethernet_rx_rule_t *rule)
+{
+  rx_classifier_rule_t r;
+  compile_rule(&r, priority, rule);
+  for (unsigned i = 0; i < c->num_rules; i++) {
+    if (memcmp(&c->rules[i], &r, sizeof(r)) == 0) {
+      c->num_rules--;
+      memmove(&c->rules[i], &c->rules[i + 1], (c->num_rules - i) * sizeof(r));
+      return;
+    }
+  }
+}
+
+void rx_classifier_clear_rules(rx_classifier_t *c)
+{
+  c->num_rules = 0;
+}
+
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_IPV4 0x0800
+#define IP_PROTO_TCP   6
+#define IP_PROTO_UDP   17
+
+// The fields of a frame are only extracted when there are rules, and then
+// once for all of them
+unsigned rx_classifier_match_rules(const rx_classifier_t *c, const unsigned *data, unsigned len)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  unsigned tagged = 0, tci = 0;
+  unsigned ip_proto = ~0u, l4_port = ~0u;
+  unsigned ip = 14;
+
+  if (c->num_rules == 0)
+    return RX_CLASSIFIER_NO_RULE;
+
+  unsigned ethertype = (p[12] << 8) | p[13];
+  if (ethertype == ETHERTYPE_VLAN && len >= 18) {
+    tagged = 1;
+    tci = (p[14] << 8) | p[15];
+    ethertype = (p[16] << 8) | p[17];
+    ip = 18;
+  }
+  if (ethertype == ETHERTYPE_IPV4 && len >= ip + 20) {
+    unsigned ihl = (p[ip] & 0xf) * 4;
+    int first_fragment = ((p[ip + 6] & 0x1f) | p[ip + 7]) == 0;
+    ip_proto = p[ip + 9];
+    if ((ip_proto == IP_PROTO_TCP || ip_proto == IP_PROTO_UDP) &&
+        first_fragment && ihl >= 20 && len >= ip + ihl + 4) {
+      l4_port = (p[ip + ihl + 2] << 8) | p[ip + ihl + 3];
+    }
+  }
+
+  for (unsigned i = 0; i < c->num_rules; i++) {
+    const rx_classifier_rule_t *r = &c->rules[i];
+    if (r->tci_mask && (!tagged || (tci & r->tci_mask) != r->tci))
+      continue;
+    if ((r->fields & ETHERNET_RX_RULE_ETHERTYPE) && ethertype != r->ethertype)
+      continue;
+    if ((r->fields & ETHERNET_RX_RULE_IP_PROTO) && ip_proto != r->ip_proto)
+      continue;
+    if ((r->fields & ETHERNET_RX_RULE_L4_PORT) && l4_port != r->l4_port)
+      continue;
+    return r->result;
+  }
+  return RX_CLASSIFIER_NO_RULE;
+}
@@ -0,0 +1,114 @@
+// Copyright (c) 2016, XMOS Ltd, All rights reserved
+#ifndef __rx_classifier_h__
+#define __rx_classifier_h__
+
+#include <stdint.h>
+#include "ethernet.h"
+#include "default_ethernet_conf.h"
+
+#ifdef __XC__
+extern "C" {
+#endif
+
+/* The ethertype filters of all the RX clients compiled into one table so
+ * that the filter thread classifies each frame with a single hashed lookup
+ * rather than every client re-parsing the header and scanning its own list.
+ * Ahead of it sits a short list of rules, kept in priority order, which can
+ * steer frames by VLAN tag, IP protocol and port.
+ */
+
+typedef struct rx_classifier_entry_t
+{
+  unsigned ethertype;   //!< The ethertype matched, 0 when the slot is empty
+  unsigned clients;     //!< Bitfield of the clients which accept it
+} rx_classifier_entry_t;
+
+typedef struct rx_classifier_rule_t
+{
+  unsigned priority;
+  unsigned fields;      //!< The ETHERNET_RX_RULE_* fields matched
+  unsigned tci_mask;    //!< The bits of the 802.1Q tag control word matched
+  unsigned tci;
+  unsigned ethertype;
+  unsigned ip_proto;
+  unsigned l4_port;
+  unsigned result;      //!< The filter result for a frame that matches
+} rx_classifier_rule_t;
+
+typedef struct rx_classifier_t
+{
+  unsigned filtered_clients;  //!< Clients which only accept listed ethertypes
+  unsigned max_probe;         //!< Longest probe sequence in the table
+  unsigned num_entries;
+  rx_classifier_entry_t entries[RX_CLASSIFIER_TABLE_SIZE];
+  unsigned num_rules;
+  rx_classifier_rule_t rules[ETHERNET_RX_RULES_MAX];
+} rx_classifier_t;
+
+/** Returned by rx_classifier_match_rules() when no rule matches. Only a
+ *  high priority result has bit 31 set, and it names a single client. */
+#define RX_CLASSIFIER_NO_RULE (~0u)
+
+void rx_classifier_init(rx_classifier_t *c);
+
+/** Let a client receive frames of an ethertype. Returns 0 if the table is
+ *  full or the ethertype is 0, which the table cannot hold. */
+int rx_classifier_add(rx_classifier_t *c, unsigned client_num, uint16_t ethertype);
+
+/** Stop a client receiving an ethertype. When the client has no ethertype
+ *  filters left, \p still_filtered is 0 and it accepts all ethertypes again.
+ */
+void rx_classifier_del(rx_classifier_t *c, unsigned client_num, uint16_t ethertype,
+                       int still_filtered);
+
+/** Add a rule after the others of the same priority. Returns 0 if the list is full. */
+int rx_classifier_add_rule(rx_classifier_t *c, unsigned priority, const ethernet_rx_rule_t *rule);
+
+void rx_classifier_del_rule(rx_classifier_t *c, unsigned priority, const ethernet_rx_rule_t *rule);
+
+void rx_classifier_clear_rules(rx_classifier_t *c);
+
+/** Returns the filter result of the first rule that the frame in \p data of
+ *  \p len bytes matches, or RX_CLASSIFIER_NO_RULE.
+ */
+unsigned rx_classifier_match_rules(const rx_classifier_t *c, const unsigned *data, unsigned len);
+
+inline unsigned rx_classifier_hash(unsigned ethertype)
+{
+  return (ethertype ^ (ethertype >> 8)) & (RX_CLASSIFIER_TABLE_SIZE - 1);
+}
+
+/** Returns the bitfield of clients that accept the frame in \p data. A frame
+ *  with an 802.1Q tag is classified on the ethertype that follows the tag.
+ */
+inline unsigned rx_classifier_lookup(const rx_classifier_t *c, const unsigned *data)
+{
+  unsigned accept = ~c->filtered_clients;
+  if (!c->filtered_clients)
+    return accept;
+
+  // Bytes 12 and 13 hold the ethertype, big-endian
+  unsigned word = data[3];
+  unsigned ethertype = ((word & 0xff) << 8) | ((word >> 8) & 0xff);
+  if (ethertype == 0x8100) {
+    word = data[4];
+    ethertype = ((word & 0xff) << 8) | ((word >> 8) & 0xff);
+  }
+
+  unsigned index = rx_classifier_hash(ethertype);
+  for (unsigned i = 0; i < c->max_probe; i++) {
+    const rx_classifier_entry_t *entry = &c->entries[index];
+    if (entry->ethertype == ethertype)
+      return accept | entry->clients;
+    if (entry->ethertype == 0)
+      break;
+    index = (index + 1) & (RX_CLASSIFIER_TABLE_SIZE - 1);
+  }
+  return accept;
+}
+
+#ifdef __XC__
+}
+#endif
+
+#endif // __rx_classifier_h__
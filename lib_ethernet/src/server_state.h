@@ -13,11 +13,61 @@ typedef struct ethernet_port_state_t
   ethernet_link_state_t link_state;
   ethernet_speed_t link_speed;
   int qav_shaper_enabled;
-  int qav_idle_slope;
+  // Each SR class is shaped with its own slope and credit limits
+  int qav_idle_slope[ETHERNET_QAV_NUM_CLASSES];
+  int qav_hi_credit[ETHERNET_QAV_NUM_CLASSES];
+  int qav_lo_credit[ETHERNET_QAV_NUM_CLASSES];
   int ingress_ts_latency[NUM_ETHERNET_SPEEDS];
   int egress_ts_latency[NUM_ETHERNET_SPEEDS];
+  // Each receive filter task and the transmit task keep their own counters
+  // so that they can be updated without locking
+  ethernet_mac_stats_t rx_stats[2];
+  ethernet_mac_stats_t tx_stats;
 } ethernet_port_state_t;
 
 void init_server_port_state(REFERENCE_PARAM(ethernet_port_state_t, state), int enable_qav_shaper);
 
+#ifdef __XC__
+unsafe void get_server_port_stats(volatile ethernet_port_state_t * unsafe state,
+                                  ethernet_mac_stats_t &stats);
+
+unsafe void set_server_port_qav_idle_slope(volatile ethernet_port_state_t * unsafe state,
+                                           ethernet_qav_class_t qav_class,
+                                           unsigned slope);
+
+unsafe void set_server_port_qav_credit_limits(volatile ethernet_port_state_t * unsafe state,
+                                              ethernet_qav_class_t qav_class,
+                                              int hi_credit, int lo_credit);
+
+// Add the credit that an SR class earns over a number of timer ticks. The
+// credit of a class with nothing queued is not kept above 0.
+inline int qav_credit_accrue(int credit, int elapsed, int idle_slope,
+                             int hi_credit, int queue_empty)
+{
+  int earned = elapsed * idle_slope;
+  if (credit > hi_credit - earned)
+    credit = hi_credit;
+  else
+    credit += earned;
+  if (queue_empty && credit > 0)
+    credit = 0;
+  return credit;
+}
+
+// Take the cost of sending a frame of len bytes from the credit of its class
+inline int qav_credit_spend(int credit, int len, int lo_credit)
+{
+  const int preamble_bytes = 8;
+  const int ifg_bytes = 96/8;
+  const int crc_bytes = 4;
+  len += preamble_bytes + ifg_bytes + crc_bytes;
+  int cost = len << (MII_CREDIT_FRACTIONAL_BITS+3);
+  if (credit < lo_credit + cost)
+    credit = lo_credit;
+  else
+    credit -= cost;
+  return credit;
+}
+#endif
+
 #endif // __server_state_h__
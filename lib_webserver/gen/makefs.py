@@ -3,6 +3,10 @@ import os
 import re
 import mimetypes
 import ConfigParser
+import gzip
+import StringIO
+import hashlib
+import fnmatch
 
 def get_id(root, name=None):
     root = root.replace('/','_')
@@ -27,7 +31,13 @@ def to_char_array(s,add_null = True):
 
 
 
-header = 'HTTP/1.0 200 OK\nServer: XMOS\nContent-type: %s\n\n'
+# The blank line that ends the header is left to the server, which first
+# adds the headers that depend on the connection
+header = 'HTTP/1.1 200 OK\nServer: XMOS\nContent-type: %s\n'
+content_length = 'Content-Length: %d\n'
+gzip_headers = 'Content-Encoding: gzip\n'
+vary = 'Vary: Accept-Encoding\n'
+validators = 'ETag: %s\nCache-Control: %s\n'
 
 fs_type_template = 0
 fs_type_binary = 1
@@ -42,17 +52,54 @@ def normalize_line_endings(s):
     return s
 
 
+def path_hash(path):
+    # 32-bit FNV-1a, as computed by simplefs_get_file()
+    h = 2166136261
+    for c in path:
+        h = ((h ^ ord(c)) * 16777619) & 0xffffffff
+    return h
+
+def path_table(paths):
+    # Open addressing with linear probing in a table at most half full
+    size = 1
+    while size < 2 * len(paths):
+        size *= 2
+    table = [None] * size
+    for (path, sym) in paths:
+        h = path_hash(path)
+        i = h & (size - 1)
+        while table[i]:
+            i = (i + 1) & (size - 1)
+        table[i] = (h, path, sym)
+    return table
+
+def gzip_bytes(data):
+    buf = StringIO.StringIO()
+    # A fixed mtime keeps the image the same from one build to the next
+    f = gzip.GzipFile(filename='', mode='wb', fileobj=buf, compresslevel=9,
+                      mtime=0)
+    f.write(data)
+    f.close()
+    return buf.getvalue()
+
+def get_etag(data, suffix=''):
+    # A strong validator that changes whenever the content does
+    return '"%s%s"' % (hashlib.sha1(data).hexdigest()[:16], suffix)
+
+def get_cache_control(path):
+    # The first [CacheControl] pattern in webserver.conf that matches the
+    # path decides, e.g. "*.png = max-age=86400"
+    for (pattern, value) in cache_rules:
+        if fnmatch.fnmatch(path, pattern):
+            return value
+    return default_cache_control
+
 def process_file(path):
     global dyn_exprs, dyn_expr_count, decls
     (typ,_) = mimetypes.guess_type(path)
     if not typ:
         typ = 'application/octet-stream'
 
-    if re.match('text/.*',typ):
-        fs_type = fs_type_template
-    else:
-        fs_type = fs_type_binary
-
     f = open(path,"rb")
     bytes = []
     while True:
@@ -63,44 +110,160 @@ def process_file(path):
 
     bytes = ''.join(bytes)
 
-    hdr = header%typ
-
-    hdr = normalize_line_endings(hdr)
+    # Text with no expressions in it is served as it is, like a binary file
+    if re.match('text/.*',typ):
+        bytes = normalize_line_endings(bytes)
+    if re.match('text/.*',typ) and '{%' in bytes:
+        fs_type = fs_type_template
+    else:
+        fs_type = fs_type_binary
 
-    out = hdr
-    length = len(hdr)
+    hdr = header%typ
 
+    # Files that are served as they are can be cached by the client, which
+    # asks whether its copy is still current with the ETag
+    etag = None
+    cache_control = None
+    if fs_type == fs_type_binary:
+        etag = get_etag(bytes)
+        rel = os.path.relpath(path, top).replace(os.sep,'/')
+        cache_control = get_cache_control(rel)
+        hdr += validators%(etag, cache_control)
+
+    # Files that are served as they are also stored gzip'd, for clients
+    # that accept it, if that makes them smaller
+    gz = None
     if fs_type == fs_type_binary:
-        out += bytes
-        length += len(bytes)
+        gz_bytes = gzip_bytes(bytes)
+        if len(gz_bytes) < len(bytes):
+            gz_etag = get_etag(bytes, '-gz')
+            gz_hdr = header%typ + validators%(gz_etag, cache_control)
+            gz_hdr += gzip_headers + vary + content_length%len(gz_bytes)
+            gz_hdr = normalize_line_endings(gz_hdr)
+            gz = (len(gz_hdr) + len(gz_bytes), len(gz_hdr), gz_hdr + gz_bytes,
+                  gz_etag)
+            hdr += vary
+
+    # A template is stored as its text with the expressions taken out and a
+    # list of segments: a span of text and the expression that follows it.
+    # An expression written {%[N] expr %} always expands to N bytes.
+    segments = None
+    if fs_type == fs_type_template:
+        (body, segments) = process_template(bytes)
+        if all(width for (_, expr, width) in segments if expr != -1):
+            body_length = len(body) + sum(width for (_, _, width) in segments)
+        else:
+            body_length = None
     else:
-        bytes = normalize_line_endings(bytes)
+        body = bytes
+        body_length = len(bytes)
+
+    # The length of a template depends on what its expressions expand to,
+    # so it can only be given up front if they all have a width
+    if body_length != None:
+        hdr += content_length%body_length
+
+    hdr = normalize_line_endings(hdr)
 
-        fchunk = False
-        for chunk in re.split('{%|%}',bytes):
-            if fchunk:
-                chunk = chunk.strip()
-                if chunk in dyn_exprs:
-                    index = dyn_exprs[chunk]
-                else:
-                    index = dyn_expr_count
-                    dyn_exprs[chunk] = index
-                    dyn_expr_count += 1
-                out += ''.join([chr(255), chr(index)])
-                length += 2
+    out = hdr + body
+    length = len(out)
+    hdr_length = len(hdr)
+
+    return (length, hdr_length, fs_type, out, gz, etag, cache_control,
+            segments)
+
+def process_template(bytes):
+    global dyn_exprs, dyn_expr_count
+    text = ''
+    span = 0
+    segments = []
+    fchunk = False
+    for chunk in re.split('{%|%}',bytes):
+        if fchunk:
+            chunk = chunk.strip()
+            m = re.match(r'\[(\d+)\](.*)$', chunk, re.S)
+            if m:
+                width = int(m.group(1))
+                chunk = m.group(2).strip()
+            else:
+                width = 0
+            if chunk in dyn_exprs:
+                index = dyn_exprs[chunk]
             else:
-                out += chunk
-                length += len(chunk)
+                index = dyn_expr_count
+                dyn_exprs[chunk] = index
+                dyn_expr_count += 1
+            segments.append((span, index, width))
+            span = 0
+        else:
+            text += chunk
+            span += len(chunk)
 
-            fchunk = not fchunk
+        fchunk = not fchunk
 
-    return (length, fs_type, out)
+    # The last span has no expression after it
+    segments.append((span, -1, 0))
+    return (text, segments)
 
 
 
 
-def traverse(root, next_ptr = 'NULL',name = ''):
+def add_file(sym, next_ptr, fs_type, length, hdr_length, gzip_ptr, data,
+             name, etag, cache_control, segments):
     global binfile, binindex
+
+    if is_flash_fs:
+        data_addr = '(simplefs_addr_t) %d' % binindex
+    else:
+        data_addr = '(simplefs_addr_t) &_data'+sym+'[0]'
+
+    # The ETag is kept in RAM so that a request can be checked against it
+    # without reading the file
+    if etag:
+        etag_ptr = '_etag' + sym
+        if cache_control not in cache_controls:
+            cache_controls[cache_control] = '_cache_control%d' % \
+                                            len(cache_controls)
+        cache_control_ptr = cache_controls[cache_control]
+    else:
+        etag_ptr = 'NULL'
+        cache_control_ptr = 'NULL'
+
+    if segments:
+        segments_ptr = '_segments' + sym
+    else:
+        segments_ptr = 'NULL'
+
+    decl = 'fs_file_t %s = {%s,%d,%d,%d,%s,%s,%s,%s,%s,%s};' % (
+        sym,
+        next_ptr,
+        fs_type,
+        length,
+        hdr_length,
+        gzip_ptr,
+        etag_ptr,
+        cache_control_ptr,
+        segments_ptr,
+        data_addr,
+        to_char_array(name))
+    decls.append(decl)
+    if etag:
+        decls.append('static char %s[] = %s;' % (etag_ptr,
+                                                 to_char_array(etag)))
+    if segments:
+        decls.append('static fs_segment_t %s[] = {%s};' % (
+            segments_ptr,
+            ','.join(['{%d,%d,%d}' % seg for seg in segments])))
+
+    if is_flash_fs:
+        binfile.write(data)
+        binindex += length
+    else:
+        decl = 'char %s[] = %s;' % ('_data'+sym,
+                                    to_char_array(data,add_null=False))
+        decls.append(decl)
+
+def traverse(root, next_ptr = 'NULL',name = ''):
     if os.path.exists(root) and os.path.isdir(root):
         fs = os.listdir(root)
     else:
@@ -123,29 +286,25 @@ def traverse(root, next_ptr = 'NULL',name = ''):
         next_ptr = get_next_ptr(root,fs,i)
         sym = get_id(root, fs[i])
         name = fs[i]
-        (length, fs_type, data) = process_file(os.path.join(root,fs[i]))
-
-        if is_flash_fs:
-            data_addr = '(simplefs_addr_t) %d' % binindex
-        else:
-            data_addr = '(simplefs_addr_t) &_data'+sym+'[0]'
+        (length, hdr_length, fs_type, data, gz, etag, cache_control,
+         segments) = process_file(os.path.join(root,fs[i]))
 
         print "Processing %s" % name
-        decl = 'fs_file_t %s = {%s,%d,%d,%s,%s};' % (sym,
-                                                     next_ptr,
-                                                     fs_type,
-                                                     length,
-                                                     data_addr,
-                                                     to_char_array(name))
-        decls.append(decl)
-
-        if is_flash_fs:
-            binfile.write(data)
-            binindex += length
-        else:
-            decl = 'char %s[] = %s;' % ('_data'+sym,
-                                        to_char_array(data,add_null=False))
-            decls.append(decl)
+        path = os.path.relpath(os.path.join(root,name), top)
+        paths.append((path.replace(os.sep,'/'), sym))
+        gz_sym = sym + '_gz'
+        add_file(sym, next_ptr, fs_type, length, hdr_length,
+                 '&' + gz_sym if gz else 'NULL', data, name, etag,
+                 cache_control, segments)
+
+        # Declared after the file so that it comes first once the
+        # declarations are reversed
+        if gz:
+            (length, hdr_length, data, gz_etag) = gz
+            print "  gzip'd to %d bytes" % (length - hdr_length)
+            add_file(gz_sym, 'NULL', fs_type_binary, length, hdr_length,
+                     'NULL', data, name + '.gz', gz_etag, cache_control,
+                     None)
 
 
     for i in range(len(subdirs)):
@@ -160,15 +319,25 @@ if __name__ == "__main__":
     hpath = sys.argv[4]
 
     is_flash_fs = False
+    default_cache_control = 'no-cache'
+    cache_rules = []
     if os.path.exists(os.path.join(root,'webserver.conf')):
         print "Found webserver.conf"
         config = ConfigParser.ConfigParser()
+        # Cache-Control patterns are paths, so keep their case
+        config.optionxform = str
         config.read(os.path.join(root,'webserver.conf'))
         try:
             if config.get('Webserver','use_flash') in ('true','True'):
                 is_flash_fs = True
         except:
             pass
+        try:
+            default_cache_control = config.get('Webserver','cache_control')
+        except:
+            pass
+        if config.has_section('CacheControl'):
+            cache_rules = config.items('CacheControl')
 
     if is_flash_fs:
         print "Generating web pages for flash"
@@ -178,7 +347,10 @@ if __name__ == "__main__":
     else:
         print "Generating web pages in program image"
 
+    top = root
     decls = []
+    paths = []
+    cache_controls = {}
     dyn_exprs = {}
     dyn_expr_count = 0;
     binindex = 4
@@ -203,6 +375,9 @@ if __name__ == "__main__":
     f.write('#include "web_server_conf.h"\n')
     f.write('#endif\n\n')
 
+    for (value, sym) in sorted(cache_controls.items(), key=lambda x: x[1]):
+        f.write('static char %s[] = %s;\n\n' % (sym, to_char_array(value)))
+
     for d in decls:
         f.write(d+'\n\n')
 
@@ -216,6 +391,22 @@ if __name__ == "__main__":
     f.write('  return 0;\n')
     f.write('}\n\n')
     f.write('fs_dir_t *root = &%s;\n\n' % get_id(root))
+
+    table = path_table(paths)
+    for entry in table:
+        if entry:
+            (h, path, sym) = entry
+            f.write('static char _path%s[] = %s;\n\n' % (sym,
+                                                      to_char_array(path)))
+    f.write('fs_path_t fs_paths[] = {\n')
+    for entry in table:
+        if entry:
+            (h, path, sym) = entry
+            f.write('  {0x%08x, _path%s, &%s},\n' % (h, sym, sym))
+        else:
+            f.write('  {0, NULL, NULL},\n')
+    f.write('};\n\n')
+    f.write('unsigned fs_paths_mask = %d;\n\n' % (len(table) - 1))
     f.close()
 
     f = open(hpath,"w")
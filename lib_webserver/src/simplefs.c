@@ -7,7 +7,8 @@
 
 simplefs_state_t simplefs_state;
 
-extern fs_dir_t *root;
+extern fs_path_t fs_paths[];
+extern unsigned fs_paths_mask;
 
 #if WEB_SERVER_USE_FLASH && !WEB_SERVER_SEPARATE_FLASH_TASK
 static fl_SPIPorts *flash_ports;
@@ -19,8 +20,15 @@ void simplefs_init(fl_SPIPorts *fports)
   return;
 #else
   simplefs_state_t *st = &simplefs_state;
-  st->cached_addr = -1;
+  for (int i=0;i<WEB_SERVER_FLASH_CACHE_LINES;i++) {
+    st->line_addr[i] = -1;
+    st->line_pinned[i] = 0;
+  }
+  st->use_count = 0;
   st->request_addr = -1;
+  st->hits = 0;
+  st->misses = 0;
+  st->prefetches = 0;
 
 #if WEB_SERVER_SEPARATE_FLASH_TASK
   mutual_comm_init_state(&st->mstate);
@@ -31,14 +39,109 @@ void simplefs_init(fl_SPIPorts *fports)
 #endif
 }
 
+void simplefs_cache_stats(unsigned *hits, unsigned *misses,
+                          unsigned *prefetches)
+{
+  simplefs_state_t *st = &simplefs_state;
+  *hits = st->hits;
+  *misses = st->misses;
+  *prefetches = st->prefetches;
+}
+
 #if WEB_SERVER_USE_FLASH
-static int data_in_cache(simplefs_addr_t addr, int len)
+#define BLOCK_OF(addr) ((addr) - (addr) % WEB_SERVER_FLASH_CACHE_SIZE)
+
+static int first_way(simplefs_addr_t block)
+{
+  int set = (block / WEB_SERVER_FLASH_CACHE_SIZE) % WEB_SERVER_FLASH_CACHE_SETS;
+  return set * WEB_SERVER_FLASH_CACHE_WAYS;
+}
+
+// The line holding a block, or -1
+static int find_line(simplefs_addr_t block)
+{
+  simplefs_state_t *st = &simplefs_state;
+  int way = first_way(block);
+  for (int i=way;i<way+WEB_SERVER_FLASH_CACHE_WAYS;i++) {
+    if (st->line_addr[i] == block)
+      return i;
+  }
+  return -1;
+}
+
+// The line to replace to make room for a block: an empty one if there is
+// one, otherwise the least recently used unpinned line in the block's
+// set, or -1 if every line in the set is pinned
+static int victim_line(simplefs_addr_t block)
 {
   simplefs_state_t *st = &simplefs_state;
-  return (addr >= st->cached_addr &&
-          (addr+len) <= (st->cached_addr+WEB_SERVER_FLASH_CACHE_SIZE));
+  int way = first_way(block);
+  int victim = -1;
+  for (int i=way;i<way+WEB_SERVER_FLASH_CACHE_WAYS;i++) {
+    if (st->line_addr[i] == -1)
+      return i;
+    if (st->line_pinned[i])
+      continue;
+    if (victim == -1 || (int) (st->line_used[i] - st->line_used[victim]) < 0)
+      victim = i;
+  }
+  return victim;
 }
+
+static char *use_line(int line)
+{
+  simplefs_state_t *st = &simplefs_state;
+  st->line_used[line] = ++st->use_count;
+  return st->local_cache[line];
+}
+
+#if !WEB_SERVER_SEPARATE_FLASH_TASK
+static int load_line(simplefs_addr_t block)
+{
+  simplefs_state_t *st = &simplefs_state;
+  // Lines are only pinned with a separate flash task, so there is always
+  // one to replace
+  int line = victim_line(block);
+  fl_connectToDevice(flash_ports,
+                     WEB_SERVER_FLASH_DEVICES,
+                     WEB_SERVER_NUM_FLASH_DEVICES);
+  fl_readData(block, WEB_SERVER_FLASH_CACHE_SIZE,
+              (unsigned char *) st->local_cache[line]);
+  fl_disconnect();
+  st->line_addr[line] = block;
+  st->misses++;
+  return line;
+}
+#endif
+
+// The cached data for one block, reading it in if need be
+static char *get_block(simplefs_addr_t block)
+{
+  int line = find_line(block);
+#if !WEB_SERVER_SEPARATE_FLASH_TASK
+  if (line == -1)
+    line = load_line(block);
+#endif
+  return use_line(line);
+}
+#endif
+
+simplefs_addr_t simplefs_uncached_block(simplefs_addr_t addr, int len)
+{
+#if !WEB_SERVER_USE_FLASH || !WEB_SERVER_SEPARATE_FLASH_TASK
+  return -1;
+#else
+  simplefs_addr_t block = BLOCK_OF(addr);
+  if (len <= 0)
+    return -1;
+  if (find_line(block) == -1)
+    return block;
+  block = BLOCK_OF(addr + len - 1);
+  if (find_line(block) == -1)
+    return block;
+  return -1;
 #endif
+}
 
 char * simplefs_get_data(chanend c_flash, simplefs_addr_t addr, int len)
 {
@@ -46,24 +149,22 @@ char * simplefs_get_data(chanend c_flash, simplefs_addr_t addr, int len)
   return (char *) addr;
 #else
   simplefs_state_t *st = &simplefs_state;
+  simplefs_addr_t block = BLOCK_OF(addr);
+  int offset = addr - block;
+  int misses = st->misses;
+  char *data = get_block(block);
 
-#if WEB_SERVER_SEPARATE_FLASH_TASK
-  return &st->local_cache[addr - st->cached_addr];
-#else
-  if (!data_in_cache(addr, len)) {
-   fl_connectToDevice(flash_ports,
-                      WEB_SERVER_FLASH_DEVICES,
-                      WEB_SERVER_NUM_FLASH_DEVICES);
-   fl_readData(addr, WEB_SERVER_FLASH_CACHE_SIZE,
-               (unsigned char *) st->local_cache);
-   st->local_cache[WEB_SERVER_FLASH_CACHE_SIZE] = 0;
-   st->cached_addr = addr;
-   fl_disconnect();
+  if (offset + len > WEB_SERVER_FLASH_CACHE_SIZE) {
+    int n = WEB_SERVER_FLASH_CACHE_SIZE - offset;
+    memcpy(st->bounce, data + offset, n);
+    data = get_block(block + WEB_SERVER_FLASH_CACHE_SIZE);
+    memcpy(st->bounce + n, data, len - n);
+    data = st->bounce;
+    offset = 0;
   }
-
-  return &st->local_cache[addr - st->cached_addr];
-#endif
-
+  if (st->misses == misses)
+    st->hits++;
+  return data + offset;
 #endif
 }
 
@@ -79,58 +180,79 @@ int simplefs_request_pending()
 
 int simplefs_data_available(chanend c_flash, simplefs_addr_t addr, int len)
 {
-#if !WEB_SERVER_USE_FLASH || !WEB_SERVER_SEPARATE_FLASH_TASK
-  return 1;
-#else
-  return data_in_cache(addr, len);
-#endif
+  return (simplefs_uncached_block(addr, len) == -1);
 }
 
-void simplefs_request_data(chanend c_flash, simplefs_addr_t addr)
+int simplefs_request_data(chanend c_flash, simplefs_addr_t addr, int prefetch)
 {
 #if !WEB_SERVER_USE_FLASH || !WEB_SERVER_SEPARATE_FLASH_TASK
-  return;
+  return 0;
 #else
   simplefs_state_t *st = &simplefs_state;
+  int line = victim_line(addr);
+  // Nothing is replaced while the data in it is still needed
+  if (line == -1)
+    return 0;
   mutual_comm_notify(c_flash, &st->mstate);
   st->request_addr = addr;
+  // The line is taken now so that nothing reads it while it is refilled
+  st->request_line = line;
+  st->line_addr[line] = -1;
+  if (prefetch)
+    st->prefetches++;
+  else
+    st->misses++;
+  return 1;
 #endif
 }
 
+void simplefs_pin_data(simplefs_addr_t addr, int len)
+{
+#if WEB_SERVER_USE_FLASH && WEB_SERVER_SEPARATE_FLASH_TASK
+  simplefs_state_t *st = &simplefs_state;
+  // Only data that can be sent straight away is kept. Keeping half of a
+  // range would hold a line for a connection that is itself waiting, and
+  // connections waiting on each other's sets would never move on.
+  if (len <= 0 || simplefs_uncached_block(addr, len) != -1)
+    return;
+  st->line_pinned[find_line(BLOCK_OF(addr))] = 1;
+  st->line_pinned[find_line(BLOCK_OF(addr + len - 1))] = 1;
+#endif
+}
 
-file_handle_t simplefs_get_file(const char path[]) {
-
-  fs_dir_t *node = root;
-
-  while (1) {
-    // skip any leading slash
-    if (*path == '/')
-      path++;
+void simplefs_unpin_all(void)
+{
+#if WEB_SERVER_USE_FLASH && WEB_SERVER_SEPARATE_FLASH_TASK
+  simplefs_state_t *st = &simplefs_state;
+  for (int i=0;i<WEB_SERVER_FLASH_CACHE_LINES;i++)
+    st->line_pinned[i] = 0;
+#endif
+}
 
-    // First try all the files
-    for(fs_file_t *file = node->files;file != NULL;file = file->next) {
-      if (strcmp(path,file->name) == 0)
-        // success
-        return (file_handle_t) file;
-    }
 
-    // Then all the sub-directories
+file_handle_t simplefs_get_file(const char path[]) {
+  unsigned hash = 2166136261;
+  unsigned i;
 
-    fs_dir_t *dir = node->children;
-    for(;dir != NULL;dir=dir->next) {
-      if (strstr(path, dir->name)==path) {
-        path += strlen(dir->name);
-        node = dir;
-        break;
-      }
-    }
+  // skip any leading slash
+  while (*path == '/')
+    path++;
 
-    if (dir)
-      continue;
+  for (const char *p = path; *p; p++) {
+    hash ^= (unsigned char) *p;
+    hash *= 16777619;
+  }
 
-    // Nothing found
-    return NULL;
+  for (i = hash & fs_paths_mask;
+       fs_paths[i].file != NULL;
+       i = (i + 1) & fs_paths_mask) {
+    if (fs_paths[i].hash == hash && strcmp(path, fs_paths[i].path) == 0)
+      // success
+      return (file_handle_t) fs_paths[i].file;
   }
+
+  // Nothing found
+  return NULL;
 }
 
 
@@ -16,10 +16,23 @@ typedef unsigned simplefs_addr_t;
 
 #ifndef __XC__
 
+// A span of a template's text and the expression that follows it. The
+// last segment of a template has no expression.
+typedef struct fs_segment_t {
+  int length;
+  int expr;   // Expression id, or -1
+  int width;  // Size the expression's output is padded to, or 0 if unbounded
+} fs_segment_t;
+
 typedef struct fs_file_t {
   struct fs_file_t *next;
   int ftype;
   int length;
+  int header_length;
+  struct fs_file_t *gzip;  // The file gzip'd, or NULL
+  char *etag;              // Quoted ETag, or NULL for templates
+  char *cache_control;     // Cache-Control value, or NULL for templates
+  fs_segment_t *segments;  // A template's segments, or NULL
   simplefs_addr_t data;
   char name[];
 } fs_file_t;
@@ -31,6 +44,14 @@ typedef struct fs_dir_t {
   char name[];
 } fs_dir_t;
 
+// A slot in the table of all files by path, generated by makefs.py.
+// Empty slots have a NULL file.
+typedef struct fs_path_t {
+  unsigned hash;
+  char *path;
+  struct fs_file_t *file;
+} fs_path_t;
+
 #endif
 
 #define INVALID_FILE (0)
@@ -44,22 +65,83 @@ char * simplefs_get_data(chanend c_flash, simplefs_addr_t addr, int len);
 #endif
 
 int  simplefs_data_available(chanend c_flash, simplefs_addr_t addr, int len);
-void simplefs_request_data(chanend c_flash, simplefs_addr_t addr);
+simplefs_addr_t simplefs_uncached_block(simplefs_addr_t addr, int len);
+int  simplefs_request_data(chanend c_flash, simplefs_addr_t addr, int prefetch);
+void simplefs_pin_data(simplefs_addr_t addr, int len);
+void simplefs_unpin_all(void);
 int simplefs_request_pending();
 void simplefs_init(NULLABLE_REFERENCE_PARAM(fl_SPIPorts, flash_ports));
 
-#ifndef WEB_SERVER_FLASH_CACHE_SIZE
+/** Get the flash cache counters. A hit is a read of data that was already
+ *  cached and a miss is a block that had to be fetched because a read
+ *  needed it. Blocks fetched ahead of need are counted as prefetches.
+ */
+void simplefs_cache_stats(REFERENCE_PARAM(unsigned, hits),
+                          REFERENCE_PARAM(unsigned, misses),
+                          REFERENCE_PARAM(unsigned, prefetches));
+
+/* The most a single send carries, and the space each connection has for
+   building one. This is a full TCP segment on Ethernet, so that headers,
+   templates and files served from flash go out a whole MSS at a time.
+   Lowering it saves that much RAM per connection, and per cache line
+   with flash, at the cost of smaller segments. */
 #ifndef WEB_SERVER_SEND_BUF_SIZE
-#define WEB_SERVER_FLASH_CACHE_SIZE 128
-#else
+#define WEB_SERVER_SEND_BUF_SIZE 1460
+#endif
+
+/* The size of a block of flash in the cache. A single read is at most
+   WEB_SERVER_SEND_BUF_SIZE bytes, which must not exceed this. */
+#ifndef WEB_SERVER_FLASH_CACHE_SIZE
 #define WEB_SERVER_FLASH_CACHE_SIZE WEB_SERVER_SEND_BUF_SIZE
 #endif
+
+/* The number of connections the web server handles at once */
+#ifndef WEB_SERVER_NUM_CONNECTIONS
+#define WEB_SERVER_NUM_CONNECTIONS 5
+#endif
+
+/* The number of places in the cache a given block can be held */
+#ifndef WEB_SERVER_FLASH_CACHE_WAYS
+#define WEB_SERVER_FLASH_CACHE_WAYS 2
+#endif
+
+/* The number of blocks the cache holds. A connection whose next send is
+   all cached keeps the one or two blocks it reads from being replaced
+   until it has sent, so by default there is at least a line per
+   connection to keep fetches for the others from waiting long. */
+#ifndef WEB_SERVER_FLASH_CACHE_LINES
+#if WEB_SERVER_NUM_CONNECTIONS > 4
+#define WEB_SERVER_FLASH_CACHE_LINES \
+  ((WEB_SERVER_NUM_CONNECTIONS + WEB_SERVER_FLASH_CACHE_WAYS - 1) / \
+   WEB_SERVER_FLASH_CACHE_WAYS * WEB_SERVER_FLASH_CACHE_WAYS)
+#else
+#define WEB_SERVER_FLASH_CACHE_LINES 4
+#endif
+#endif
+
+#define WEB_SERVER_FLASH_CACHE_SETS \
+  (WEB_SERVER_FLASH_CACHE_LINES / WEB_SERVER_FLASH_CACHE_WAYS)
+
+/* The number of blocks to fetch ahead of each connection's position in
+   the file it is sending, when using a separate flash task */
+#ifndef WEB_SERVER_FLASH_READ_AHEAD
+#define WEB_SERVER_FLASH_READ_AHEAD 1
 #endif
 
 typedef struct simplefs_state_t {
-  char local_cache[WEB_SERVER_FLASH_CACHE_SIZE+1];
-  simplefs_addr_t cached_addr;
+  char local_cache[WEB_SERVER_FLASH_CACHE_LINES][WEB_SERVER_FLASH_CACHE_SIZE];
+  simplefs_addr_t line_addr[WEB_SERVER_FLASH_CACHE_LINES];
+  unsigned line_used[WEB_SERVER_FLASH_CACHE_LINES];
+  // Lines that must not be replaced
+  char line_pinned[WEB_SERVER_FLASH_CACHE_LINES];
+  unsigned use_count;
+  // Reads that span two blocks are put together here
+  char bounce[WEB_SERVER_FLASH_CACHE_SIZE];
   simplefs_addr_t request_addr;
+  int request_line;
+  unsigned hits;
+  unsigned misses;
+  unsigned prefetches;
   mutual_comm_state_t mstate;
 } simplefs_state_t;
 
@@ -1,5 +1,6 @@
 // Copyright (c) 2016, XMOS Ltd, All rights reserved
 #include <string.h>
+#include <ctype.h>
 #include "web_server.h"
 #include "simplefs.h"
 #include "print.h"
@@ -14,55 +15,116 @@
 #define WEB_SERVER_PORT 80
 #endif
 
-#ifndef WEB_SERVER_NUM_CONNECTIONS
-#define WEB_SERVER_NUM_CONNECTIONS 5
-#endif
-
 #ifndef WEB_SERVER_MAX_URI_LENGTH
-#define WEB_SERVER_MAX_URI_LENGTH 64
+#define WEB_SERVER_MAX_URI_LENGTH 128
 #endif
 
 #ifndef WEB_SERVER_MAX_PARAMS_LENGTH
 #define WEB_SERVER_MAX_PARAMS_LENGTH 64
 #endif
 
-#ifndef WEB_SERVER_SEND_BUF_SIZE
-#define WEB_SERVER_SEND_BUF_SIZE 128
+// Space per connection for the output of a template expression, which is
+// sent over as many segments as it needs
+#ifndef WEB_SERVER_EXPR_BUF_SIZE
+#define WEB_SERVER_EXPR_BUF_SIZE 128
 #endif
 
 #ifndef WEB_SERVER_CHECK_FLASH_SIGNATURE
 #define WEB_SERVER_CHECK_FLASH_SIGNATURE 1
 #endif
 
+// How long in milliseconds a persistent connection may wait for its next
+// request before it is closed. Zero closes every connection after one
+// response, as an HTTP/1.0 server would.
+#ifndef WEB_SERVER_KEEP_ALIVE_TIMEOUT
+#define WEB_SERVER_KEEP_ALIVE_TIMEOUT 5000
+#endif
+
+// Space per connection for pipelined requests that arrive while a
+// response is still being sent
+#ifndef WEB_SERVER_PIPELINE_BUF_SIZE
+#define WEB_SERVER_PIPELINE_BUF_SIZE 256
+#endif
+
+// Size line and trailing CRLF around each chunk of a chunked body
+#define CHUNK_HEADER_LEN 6
+#define CHUNK_OVERHEAD (CHUNK_HEADER_LEN + 2)
+
 typedef enum {
   PARSING_METHOD,
   PARSING_URI,
+  PARSING_QUERY,
+  PARSING_VERSION,
   PARSING_HEADERS,
-  PARSING_HEADER,
-  PARSING_PARAMS,
+  PARSING_HEADER_NAME,
+  PARSING_HEADER_VALUE,
+  PARSING_SKIP_LINE,
+  PARSING_BODY,
   PARSING_IDLE
 } parsing_state_t;
 
+typedef enum {
+  HEADER_OTHER,
+  HEADER_CONTENT_LENGTH,
+  HEADER_CONNECTION,
+  HEADER_ACCEPT_ENCODING,
+  HEADER_IF_NONE_MATCH
+} request_header_t;
+
+// Which of the file's representations the client already has
+#define ETAG_MATCH      1
+#define ETAG_MATCH_GZIP 2
+
 typedef enum {
   REQUEST_UNKNOWN,
   REQUEST_GET,
   REQUEST_POST
 } request_method_t;
 
+typedef enum {
+  CONNECTION_DEFAULT,
+  CONNECTION_CLOSE,
+  CONNECTION_KEEP_ALIVE
+} connection_header_t;
+
 typedef struct connection_state_t {
   int active;
   int conn_id;
   int is_template;
+  int length_known;
   char current_data[WEB_SERVER_SEND_BUF_SIZE];
   int  current_data_len;
+  int send_from_file;
+  simplefs_addr_t file_data;
   simplefs_addr_t next_data;
+  simplefs_addr_t end_of_header;
   simplefs_addr_t end_of_data;
+  fs_segment_t *segment;
+  int span_left;
+  char expr_buf[WEB_SERVER_EXPR_BUF_SIZE];
+  int expr_out;
+  int expr_len;
+  int expr_pos;
+  char uri[WEB_SERVER_MAX_URI_LENGTH+1];
+  int uri_len;
   char params[WEB_SERVER_MAX_PARAMS_LENGTH+1];
   int params_len;
   int content_len;
   int sending_paused;
   parsing_state_t parsing_state;
   request_method_t request_method;
+  request_header_t header;
+  int status;
+  int http11;
+  int accept_gzip;
+  int etag_match;
+  connection_header_t connection_header;
+  int keep_alive;
+  int chunked;
+  int chunk_end_pending;
+  int idle;
+  char pending[WEB_SERVER_PIPELINE_BUF_SIZE];
+  int pending_len;
   file_handle_t file;
 } connection_state_t;
 
@@ -113,9 +175,18 @@ int web_server_is_post(int st0)
   return (st->request_method == REQUEST_POST);
 }
 
+// Whether all of the body has been rendered. A template's last segment
+// has no expression, so one to come leaves the body unfinished even when
+// all of the file has been read.
+static int body_done(connection_state_t *st)
+{
+  return (st->next_data >= st->end_of_data &&
+          (!st->segment || st->segment->expr < 0));
+}
+
 int web_server_end_of_page(int st0) {
   connection_state_t *st = (connection_state_t *) st0;
-  return (st->next_data >= st->end_of_data);
+  return body_done(st);
 }
 
 file_handle_t web_server_get_current_file(int st0) {
@@ -157,22 +228,69 @@ int web_server_copy_param(const char param[], int st, char buf[])
 
 
 
-static connection_state_t * get_new_state() {
+static void reset_request(connection_state_t *st)
+{
+  st->parsing_state = PARSING_METHOD;
+  st->request_method = REQUEST_UNKNOWN;
+  st->uri_len = 0;
+  st->params_len = 0;
+  st->content_len = -1;
+  st->status = 0;
+  st->http11 = 0;
+  st->accept_gzip = 0;
+  st->etag_match = 0;
+  st->connection_header = CONNECTION_DEFAULT;
+}
+
+static void init_state(connection_state_t *st)
+{
+  st->active = 1;
+  st->sending_paused = 0;
+  st->keep_alive = 0;
+  st->idle = 0;
+  st->pending_len = 0;
+  reset_request(st);
+}
+
+static connection_state_t * get_new_state(chanend c_xtcp) {
   for (int i=0;i<WEB_SERVER_NUM_CONNECTIONS;i++) {
     if (!connection_state[i].active) {
-      connection_state[i].active = 1;
-      connection_state[i].parsing_state = PARSING_METHOD;
-      connection_state[i].request_method = REQUEST_UNKNOWN;
-      connection_state[i].params_len = 0;
-      connection_state[i].content_len = -1;
-      connection_state[i].sending_paused = 0;
+      init_state(&connection_state[i]);
       return &connection_state[i];
     }
   }
+
+  // All in use, so take over a persistent connection that is waiting for
+  // its next request. Events still to come for it are ignored as they
+  // carry the old connection id.
+  for (int i=0;i<WEB_SERVER_NUM_CONNECTIONS;i++) {
+    connection_state_t *st = &connection_state[i];
+    if (st->keep_alive &&
+        st->parsing_state == PARSING_METHOD &&
+        st->uri_len == 0 &&
+        st->pending_len == 0) {
+      xtcp_connection_t conn;
+      conn.id = st->conn_id;
+      xtcp_close(c_xtcp, &conn);
+      init_state(st);
+      return st;
+    }
+  }
   return NULL;
 }
 
 
+// Whether every expression in a template has a width, so that the length
+// of the body is known before it is rendered
+static int template_sized(fs_segment_t *seg)
+{
+  for (; seg->expr >= 0; seg++) {
+    if (!seg->width)
+      return 0;
+  }
+  return 1;
+}
+
 static void get_resource(connection_state_t *st,
                          const char *uri)
 {
@@ -188,172 +306,564 @@ static void get_resource(connection_state_t *st,
 
   if (f) {
     st->is_template = (f->ftype == FS_TYPE_TEMPLATE);
+    st->length_known = !st->is_template || template_sized(f->segments);
     st->next_data = f->data;
+    st->end_of_header = f->data + f->header_length;
     st->end_of_data = f->data + f->length;
+    st->segment = f->segments;
+    st->span_left = f->segments ? f->segments->length : 0;
+    st->expr_len = -1;
     st->file = (file_handle_t) f;
   }
   else {
     st->next_data = 0;
+    st->end_of_header = 0;
     st->end_of_data = 0;
+    st->segment = NULL;
     st->file = 0;
   }
 
 }
 
-static void set_content_length(connection_state_t *st)
+// The gzip'd copy of the file, if it has one, when the client said it can
+// take it. The copy is not in the directory so the file handle stays that
+// of the file requested.
+static fs_file_t *representation(connection_state_t *st)
 {
-  if (strncmp(st->current_data,"Content-Length",14)==0) {
-    char *end = st->current_data + st->current_data_len - 1;
-    char *p = skip_word(st->current_data, end)+1;
-    int len;
-    len = atoi(p);
-    st->content_len = len;
+  fs_file_t *f = (fs_file_t *) st->file;
+
+  if (f && f->gzip && st->accept_gzip)
+    return f->gzip;
+  return f;
+}
+
+static void select_encoding(connection_state_t *st)
+{
+  fs_file_t *f = representation(st);
+
+  if (f && f != (fs_file_t *) st->file) {
+    st->next_data = f->data;
+    st->end_of_header = f->data + f->header_length;
+    st->end_of_data = f->data + f->length;
   }
 }
 
-static void parse_http_request(chanend c_xtcp,
-                               xtcp_connection_t *conn,
-                               connection_state_t *st,
-                               char *buf,
-                               int len)
+// Whether an If-None-Match value lists an ETag. The comparison is weak,
+// so a W/ prefix is ignored.
+static int etag_listed(const char *p, const char *etag)
+{
+  int n;
+
+  if (!etag)
+    return 0;
+  n = strlen(etag);
+  while (*p) {
+    while (*p == ' ' || *p == ',')
+      p++;
+    if (*p == '*')
+      return 1;
+    if (p[0] == 'W' && p[1] == '/')
+      p += 2;
+    if (strncmp(p, etag, n) == 0 &&
+        (p[n] == 0 || p[n] == ',' || p[n] == ' '))
+      return 1;
+    while (*p && *p != ',')
+      p++;
+  }
+  return 0;
+}
+
+// The client's copy is current if it has the ETag of the representation
+// that would be sent
+static int not_modified(connection_state_t *st)
+{
+  fs_file_t *f = representation(st);
+
+  if (st->request_method != REQUEST_GET || !f)
+    return 0;
+  if (f == (fs_file_t *) st->file)
+    return (st->etag_match & ETAG_MATCH) != 0;
+  return (st->etag_match & ETAG_MATCH_GZIP) != 0;
+}
+
+// Whether an Accept-Encoding value allows gzip. A q-value of zero
+// refuses it.
+static int gzip_accepted(const char *p)
+{
+  p = strstr(p, "gzip");
+  if (!p)
+    return 0;
+  p += 4;
+  while (*p == ' ')
+    p++;
+  if (strncmp(p, ";q=", 3) != 0)
+    return 1;
+  for (p += 3; *p && *p != ','; p++) {
+    if (*p >= '1' && *p <= '9')
+      return 1;
+  }
+  return 0;
+}
+
+// Compare a header name with one the server looks for, ignoring case
+static int header_is(const char *name, const char *want)
+{
+  while (*want) {
+    if (tolower((unsigned char) *name) != tolower((unsigned char) *want))
+      return 0;
+    name++;
+    want++;
+  }
+  return (*name == 0);
+}
+
+// Whether a header value starts with a token, ignoring case
+static int value_is(const char *p, const char *token)
+{
+  int n = strlen(token);
+  for (int i=0;i<n;i++) {
+    if (tolower((unsigned char) p[i]) != token[i])
+      return 0;
+  }
+  return (p[n] == 0 || p[n] == ',' || p[n] == ' ' || p[n] == ';');
+}
+
+static request_header_t find_header(const char *name)
+{
+  if (header_is(name, "Content-Length"))
+    return HEADER_CONTENT_LENGTH;
+  if (header_is(name, "Connection"))
+    return HEADER_CONNECTION;
+  if (header_is(name, "Accept-Encoding"))
+    return HEADER_ACCEPT_ENCODING;
+  if (header_is(name, "If-None-Match"))
+    return HEADER_IF_NONE_MATCH;
+  return HEADER_OTHER;
+}
+
+// The value of a header the server looks for is in current_data
+static void process_header(connection_state_t *st)
+{
+  char *p = st->current_data;
+
+  switch (st->header)
+    {
+    case HEADER_CONTENT_LENGTH:
+      st->content_len = atoi(p);
+      break;
+    case HEADER_CONNECTION:
+      if (value_is(p, "close"))
+        st->connection_header = CONNECTION_CLOSE;
+      else if (value_is(p, "keep-alive"))
+        st->connection_header = CONNECTION_KEEP_ALIVE;
+      break;
+    case HEADER_ACCEPT_ENCODING:
+      st->accept_gzip = gzip_accepted(p);
+      break;
+    case HEADER_IF_NONE_MATCH:
+      // The file is known by now but the encoding may not be, so both
+      // representations are checked
+      if (st->file) {
+        fs_file_t *f = (fs_file_t *) st->file;
+        st->etag_match = 0;
+        if (etag_listed(p, f->etag))
+          st->etag_match |= ETAG_MATCH;
+        if (f->gzip && etag_listed(p, f->gzip->etag))
+          st->etag_match |= ETAG_MATCH_GZIP;
+      }
+      break;
+    default:
+      break;
+    }
+}
+
+static const char *status_line(int status)
+{
+  switch (status)
+    {
+    case 304:
+      return "HTTP/1.1 304 Not Modified\r\n";
+    case 400:
+      return "HTTP/1.1 400 Bad Request\r\n";
+    case 404:
+      return "HTTP/1.1 404 Not Found\r\n";
+    case 414:
+      return "HTTP/1.1 414 URI Too Long\r\n";
+    default:
+      return "HTTP/1.1 501 Not Implemented\r\n";
+    }
+}
+
+// The headers that end the response header depend on the connection
+static const char *connection_headers(connection_state_t *st)
+{
+  if (!st->keep_alive)
+    return "Connection: close\r\n\r\n";
+  if (st->chunked)
+    return "Transfer-Encoding: chunked\r\n\r\n";
+  if (!st->http11)
+    return "Connection: keep-alive\r\n\r\n";
+  return "\r\n";
+}
+
+static int append(char *dst, int len, const char *s)
 {
-  // We make the assumption that the uri  is contained in the fisrt
-  // chunk of data we get so we don't have to maintain a partial uri string
-  // per connection
+  int n = strlen(s);
+  if (len < 0 || len + n > WEB_SERVER_SEND_BUF_SIZE)
+    return -1;
+  memcpy(dst + len, s, n);
+  return len + n;
+}
+
+// A response with no body is built whole in the send buffer. Returns zero
+// if it does not fit.
+static int prepare_status(connection_state_t *st)
+{
+  char *dst = st->current_data;
+  int len;
+
+  len = append(dst, 0, status_line(st->status));
+  len = append(dst, len, "Server: XMOS\r\n");
+  if (st->status == 304) {
+    // The headers the full response would have had for caches
+    fs_file_t *f = representation(st);
+    len = append(dst, len, "ETag: ");
+    len = append(dst, len, f->etag);
+    len = append(dst, len, "\r\nCache-Control: ");
+    len = append(dst, len, f->cache_control);
+    len = append(dst, len, "\r\n");
+    if (((fs_file_t *) st->file)->gzip)
+      len = append(dst, len, "Vary: Accept-Encoding\r\n");
+  }
+  else
+    len = append(dst, len, "Content-Length: 0\r\n");
+  len = append(dst, len, connection_headers(st));
+  if (len < 0)
+    return 0;
+
+  st->current_data_len = len;
+  st->send_from_file = 0;
+  return 1;
+}
+
+static void start_response(chanend c_xtcp,
+                           xtcp_connection_t *conn,
+                           connection_state_t *st)
+{
+  // A request that could not be parsed leaves the rest of the stream
+  // unknown, so the connection is closed after the error
+  int failed = (st->status != 0);
+
+  if (failed)
+    st->file = 0;
+  else if (!st->file)
+    st->status = 404;
+  else if (not_modified(st))
+    st->status = 304;
+
+  // HTTP/1.1 connections persist unless the client says otherwise and
+  // HTTP/1.0 ones only if it asks. A body whose length is not known
+  // up front can only be delimited on a persistent connection by chunked
+  // coding, which HTTP/1.0 clients do not understand.
+  if (st->http11)
+    st->keep_alive = (st->connection_header != CONNECTION_CLOSE);
+  else
+    st->keep_alive = (st->connection_header == CONNECTION_KEEP_ALIVE &&
+                      !(st->file && !st->length_known));
+  if (failed || WEB_SERVER_KEEP_ALIVE_TIMEOUT == 0)
+    st->keep_alive = 0;
+  st->chunked = st->keep_alive && st->file && !st->length_known;
+
+  // A 304 whose headers do not fit is sent as the whole file instead
+  if (st->status && !prepare_status(st))
+    st->status = 0;
+
+  if (st->status) {
+    st->chunked = 0;
+    st->segment = NULL;
+    st->next_data = 0;
+    st->end_of_header = 0;
+    st->end_of_data = 0;
+  }
+  else
+    select_encoding(st);
+  st->chunk_end_pending = st->chunked;
+
+  xtcp_init_send(c_xtcp, conn);
+  st->parsing_state = PARSING_IDLE;
+}
+
+// Give up on a request and answer it with an error status
+static void reject_request(chanend c_xtcp,
+                           xtcp_connection_t *conn,
+                           connection_state_t *st,
+                           int status)
+{
+  st->status = status;
+  start_response(c_xtcp, conn, st);
+}
+
+static void add_param_char(connection_state_t *st, char c)
+{
+  if (st->params_len < WEB_SERVER_MAX_PARAMS_LENGTH) {
+    st->params[st->params_len] = (c == '&' || c == '=') ? 0 : c;
+    st->params_len++;
+  }
+}
+
+// Returns the number of bytes used. Parsing stops at the end of a request
+// so that anything pipelined after it is left for the next one. All the
+// state is kept in st, so a request may arrive split at any point.
+static int parse_http_request(chanend c_xtcp,
+                              xtcp_connection_t *conn,
+                              connection_state_t *st,
+                              char *buf,
+                              int len)
+{
+  char *start = buf;
   char *end = buf+len;
-  char uri[WEB_SERVER_MAX_URI_LENGTH+1];
-  int uri_len = 0;
 
   while (buf < end) {
     switch (st->parsing_state)
       {
       case PARSING_METHOD:
-        if (strncmp(buf,"GET ",4)==0) {
-          st->request_method = REQUEST_GET;
-          buf += 4;
-          st->parsing_state = PARSING_URI;
-        } else if (strncmp(buf,"POST ",5)==0) {
-          st->request_method = REQUEST_POST;
-          buf += 5;
+        // The method is collected in the uri buffer until its space
+        switch (*buf) {
+        case ' ':
+          st->uri[st->uri_len] = 0;
+          if (strcmp(st->uri,"GET")==0)
+            st->request_method = REQUEST_GET;
+          else if (strcmp(st->uri,"POST")==0)
+            st->request_method = REQUEST_POST;
+          else {
+            reject_request(c_xtcp, conn, st, 501);
+            return len;
+          }
+          st->uri_len = 0;
           st->parsing_state = PARSING_URI;
-        } else {
-          st->parsing_state = PARSING_IDLE;
-          xtcp_abort(c_xtcp, conn);
-          return;
+          break;
+        case 13:
+        case 10:
+          // Clients may send an empty line between requests
+          if (st->uri_len) {
+            reject_request(c_xtcp, conn, st, 400);
+            return len;
+          }
+          break;
+        default:
+          if (st->uri_len == WEB_SERVER_MAX_URI_LENGTH) {
+            reject_request(c_xtcp, conn, st, 501);
+            return len;
+          }
+          st->uri[st->uri_len] = *buf;
+          st->uri_len++;
+          break;
         }
+        buf++;
         break;
       case PARSING_URI:
         switch (*buf) {
         case ' ':
-          uri[uri_len] = 0;
-          get_resource(st, uri);
-          st->parsing_state = PARSING_HEADERS;
+          st->uri[st->uri_len] = 0;
+          get_resource(st, st->uri);
+          st->current_data_len = 0;
+          st->parsing_state = PARSING_VERSION;
           break;
         case '?':
-          uri[uri_len] = 0;
-          get_resource(st, uri);
-          st->parsing_state = PARSING_PARAMS;
+          st->uri[st->uri_len] = 0;
+          get_resource(st, st->uri);
+          st->parsing_state = PARSING_QUERY;
+          break;
+        case 13:
+        case 10:
+          reject_request(c_xtcp, conn, st, 400);
+          return len;
+        default:
+          if (st->uri_len == WEB_SERVER_MAX_URI_LENGTH) {
+            reject_request(c_xtcp, conn, st, 414);
+            return len;
+          }
+          st->uri[st->uri_len] = *buf;
+          st->uri_len++;
+          break;
+        }
+        buf++;
+        break;
+      case PARSING_QUERY:
+        switch (*buf) {
+        case ' ':
+          st->params[st->params_len] = 0;
+          st->params_len++;
+          st->current_data_len = 0;
+          st->parsing_state = PARSING_VERSION;
+          break;
+        case 13:
+        case 10:
+          reject_request(c_xtcp, conn, st, 400);
+          return len;
+        default:
+          if (st->params_len == WEB_SERVER_MAX_PARAMS_LENGTH) {
+            reject_request(c_xtcp, conn, st, 414);
+            return len;
+          }
+          add_param_char(st, *buf);
+          break;
+        }
+        buf++;
+        break;
+      case PARSING_VERSION:
+        // The rest of the request line is collected in current_data,
+        // which is not needed for sending until the response starts
+        switch (*buf) {
+        case 13:
+          break;
+        case 10:
+          st->current_data[st->current_data_len] = 0;
+          if (strncmp(st->current_data,"HTTP/1.",7)!=0) {
+            reject_request(c_xtcp, conn, st, 400);
+            return len;
+          }
+          st->http11 = (st->current_data[7] != '0');
+          st->parsing_state = PARSING_HEADERS;
           break;
         default:
-          if (uri_len < WEB_SERVER_MAX_URI_LENGTH) {
-            uri[uri_len] = *buf;
-            uri_len++;
+          if (st->current_data_len < WEB_SERVER_SEND_BUF_SIZE-1) {
+            st->current_data[st->current_data_len] = *buf;
+            st->current_data_len++;
           }
           break;
         }
         buf++;
         break;
       case PARSING_HEADERS:
+        // Lines end at the LF, which may arrive apart from its CR
         switch (*buf)
           {
           case 13:
-            buf++;
+            break;
           case 10:
-            buf++;
-            if (st->request_method == REQUEST_POST)
-              st->parsing_state = PARSING_PARAMS;
+            if (st->request_method == REQUEST_POST && st->content_len > 0)
+              st->parsing_state = PARSING_BODY;
             else {
-              xtcp_init_send(c_xtcp, conn);
-              st->parsing_state = PARSING_IDLE;
+              start_response(c_xtcp, conn, st);
+              return buf + 1 - start;
             }
             break;
           default:
-            // This code reuses the current_data array to store
-            // the header names
             st->current_data[0] = *buf;
-            buf++;
-            st->parsing_state = PARSING_HEADER;
             st->current_data_len = 1;
+            st->parsing_state = PARSING_HEADER_NAME;
             break;
           }
+        buf++;
         break;
-      case PARSING_HEADER:
+      case PARSING_HEADER_NAME:
         switch (*buf)
           {
-          case 13:
-            buf++;
-          case 10:
-            buf++;
+          case ':':
             st->current_data[st->current_data_len] = 0;
-            set_content_length(st);
+            st->header = find_header(st->current_data);
+            st->current_data_len = 0;
+            if (st->header == HEADER_OTHER)
+              st->parsing_state = PARSING_SKIP_LINE;
+            else
+              st->parsing_state = PARSING_HEADER_VALUE;
+            break;
+          case 10:
+            // Not a header, so ignore it
             st->parsing_state = PARSING_HEADERS;
             break;
           default:
-            if (st->current_data_len < WEB_SERVER_SEND_BUF_SIZE-1) {
-              if (*buf==':')
-                st->current_data[st->current_data_len] = 0;
-              else
-                st->current_data[st->current_data_len] = *buf;
+            // No header name the server looks for is this long
+            if (st->current_data_len == WEB_SERVER_SEND_BUF_SIZE-1)
+              st->parsing_state = PARSING_SKIP_LINE;
+            else {
+              st->current_data[st->current_data_len] = *buf;
               st->current_data_len++;
             }
-            buf++;
             break;
           }
+        buf++;
         break;
-      case PARSING_PARAMS:
+      case PARSING_HEADER_VALUE:
         switch (*buf)
           {
-          case ' ':
-            st->params[st->params_len] = 0;
-            st->params_len++;
-            st->parsing_state = PARSING_HEADERS;
-            break;
           case 13:
-          case 10:
-            st->params[st->params_len] = 0;
-            st->params_len++;
-            xtcp_init_send(c_xtcp, conn);
-            st->parsing_state = PARSING_IDLE;
             break;
-          case '&':
-          case '=':
-            if (st->params_len < WEB_SERVER_MAX_PARAMS_LENGTH) {
-              st->params[st->params_len] = 0;
-              st->params_len++;
-            }
+          case 10:
+            st->current_data[st->current_data_len] = 0;
+            process_header(st);
+            st->parsing_state = PARSING_HEADERS;
             break;
+          case ' ':
+          case '\t':
+            if (st->current_data_len == 0)
+              break;
+            // fall through
           default:
-            if (st->params_len < WEB_SERVER_MAX_PARAMS_LENGTH) {
-              st->params[st->params_len] = *buf;
-              st->params_len++;
+            if (st->current_data_len < WEB_SERVER_SEND_BUF_SIZE-1) {
+              st->current_data[st->current_data_len] = *buf;
+              st->current_data_len++;
             }
             break;
           }
-        if (st->content_len > 0) {
-          st->content_len--;
+        buf++;
+        break;
+      case PARSING_SKIP_LINE: {
+        // Headers the server has no use for are skipped without looking
+        // at anything but the line ends
+        char *eol = memchr(buf, 10, end - buf);
+        if (!eol)
+          return len;
+        buf = eol + 1;
+        st->parsing_state = PARSING_HEADERS;
         }
+        break;
+      case PARSING_BODY:
+        // The body of a POST is form data
+        add_param_char(st, *buf);
+        st->content_len--;
         buf++;
+        if (st->content_len == 0) {
+          st->params[st->params_len] = 0;
+          st->params_len++;
+          start_response(c_xtcp, conn, st);
+          return buf - start;
+        }
         break;
       case PARSING_IDLE:
-        // Nothing to do
-        return;
+        return buf - start;
       }
   }
-  if (st->parsing_state == PARSING_PARAMS &&
-      st->content_len == 0) {
-    st->params[st->params_len] = 0;
-    xtcp_init_send(c_xtcp, conn);
-    st->parsing_state = PARSING_IDLE;
+  return len;
+}
+
+static void hold_request_data(connection_state_t *st, char *data, int len)
+{
+  if (len <= 0)
+    return;
+
+  if (st->pending_len + len > WEB_SERVER_PIPELINE_BUF_SIZE) {
+    // The data is already acknowledged so cannot be pushed back. Close
+    // after the current response so that the client sends the requests
+    // it has no answer to again on a new connection.
+    st->pending_len = 0;
+    st->keep_alive = 0;
+    return;
+  }
+  memcpy(&st->pending[st->pending_len], data, len);
+  st->pending_len += len;
+}
+
+static void next_request(chanend c_xtcp,
+                         xtcp_connection_t *conn,
+                         connection_state_t *st)
+{
+  reset_request(st);
+  if (st->pending_len) {
+    int n = parse_http_request(c_xtcp, conn, st, st->pending, st->pending_len);
+    st->pending_len -= n;
+    memmove(st->pending, &st->pending[n], st->pending_len);
   }
 }
 
@@ -362,6 +872,62 @@ extern int web_server_dyn_expr(int exp,
                                int app_state,
                                int connection_state);
 
+// The file data the connection's next send may need
+static int send_data_len(connection_state_t *st)
+{
+  int len = st->end_of_data - st->next_data;
+  return len < WEB_SERVER_SEND_BUF_SIZE ? len : WEB_SERVER_SEND_BUF_SIZE;
+}
+
+static void update_data_cache(chanend c_flash)
+{
+  static int next_conn = 0;
+
+  if (simplefs_request_pending())
+    return;
+
+  // The blocks each connection's next send reads from are kept once they
+  // are all cached, so that neither a fetch nor a read ahead for another
+  // connection can take them between a sender being woken and it sending
+  simplefs_unpin_all();
+  for (int i=0;i<WEB_SERVER_NUM_CONNECTIONS;i++) {
+    connection_state_t *st = &connection_state[i];
+    if (st->active && st->next_data < st->end_of_data)
+      simplefs_pin_data(st->next_data, send_data_len(st));
+  }
+
+  // Fetch what a connection is waiting for first, then read ahead of each
+  // connection in turn. Starting where the last fetch left off shares the
+  // flash between connections. A block whose set is all pinned is left
+  // until one of the connections holding it has sent, which it can do
+  // without any further fetch.
+  for (int ahead=0;ahead<=WEB_SERVER_FLASH_READ_AHEAD;ahead++) {
+    for (int k=0;k<WEB_SERVER_NUM_CONNECTIONS;k++) {
+      int i = (next_conn + k) % WEB_SERVER_NUM_CONNECTIONS;
+      connection_state_t *st = &connection_state[i];
+      simplefs_addr_t addr;
+
+      if (!st->active || st->next_data >= st->end_of_data)
+        continue;
+
+      if (ahead == 0)
+        addr = simplefs_uncached_block(st->next_data, send_data_len(st));
+      else {
+        addr = st->next_data + send_data_len(st) - 1 +
+               ahead * WEB_SERVER_FLASH_CACHE_SIZE;
+        if (addr >= st->end_of_data)
+          continue;
+        addr = simplefs_uncached_block(addr, 1);
+      }
+
+      if (addr != -1 && simplefs_request_data(c_flash, addr, ahead != 0)) {
+        next_conn = i + 1;
+        return;
+      }
+    }
+  }
+}
+
 void web_server_unpause_senders(chanend c_flash, chanend c_xtcp)
 {
   for (int i=0;i<WEB_SERVER_NUM_CONNECTIONS;i++) {
@@ -370,7 +936,7 @@ void web_server_unpause_senders(chanend c_flash, chanend c_xtcp)
         st->sending_paused &&
         simplefs_data_available(c_flash,
                                 st->next_data,
-                                WEB_SERVER_SEND_BUF_SIZE))
+                                send_data_len(st)))
       {
         xtcp_connection_t conn;
         conn.id = st->conn_id;
@@ -378,91 +944,158 @@ void web_server_unpause_senders(chanend c_flash, chanend c_xtcp)
         st->sending_paused = 0;
       }
   }
+  // Keep the flash task busy reading ahead
+  update_data_cache(c_flash);
 }
 
-static void update_data_cache(chanend c_flash)
+// Evaluate the expression at the end of the current segment. Output that
+// does not fill the expression's width is padded with spaces.
+static void start_expr(connection_state_t *st)
 {
-  simplefs_addr_t addr=-1;
+  int len = web_server_dyn_expr(st->segment->expr, st->expr_buf,
+                                app_state, (int) st);
+  if (len > WEB_SERVER_EXPR_BUF_SIZE)
+    len = WEB_SERVER_EXPR_BUF_SIZE;
+  if (len < 0)
+    len = 0;
+  st->expr_out = len;
+  st->expr_len = st->segment->width ? st->segment->width : len;
+  if (st->expr_out > st->expr_len)
+    st->expr_out = st->expr_len;
+  st->expr_pos = 0;
+}
 
-  if (simplefs_request_pending())
-    return;
+// Fill at most room bytes of dst with the file body and return the
+// number of bytes used. A template's text is copied a span at a time and
+// an expression's output may be split between sends.
+static int render_body(chanend c_flash, connection_state_t *st,
+                       char *dst, int room)
+{
+  int len = 0;
 
-  for (int i=0;i<WEB_SERVER_NUM_CONNECTIONS;i++) {
-    connection_state_t *st = &connection_state[i];
-    if (st->active) {
-      if (simplefs_data_available(c_flash,
-                                  st->next_data,
-                                  WEB_SERVER_SEND_BUF_SIZE))
-        // Data is available that could be used
-        return;
-      if (st->next_data < st->end_of_data)
-        addr = st->next_data;
+  if (!st->is_template) {
+    len = st->end_of_data - st->next_data;
+    if (len > room)
+      len = room;
+    if (len <= 0)
+      return 0;
+    memcpy(dst, simplefs_get_data(c_flash, st->next_data, len), len);
+    st->next_data += len;
+    return len;
+  }
+
+  while (len < room) {
+    int n;
+    if (st->span_left) {
+      n = st->span_left < room - len ? st->span_left : room - len;
+      memcpy(dst + len, simplefs_get_data(c_flash, st->next_data, n), n);
+      st->next_data += n;
+      st->span_left -= n;
+    }
+    else if (st->segment->expr < 0) {
+      break;
     }
+    else {
+      if (st->expr_len < 0)
+        start_expr(st);
+      n = st->expr_len - st->expr_pos;
+      if (n > room - len)
+        n = room - len;
+      for (int i = 0; i < n; i++, st->expr_pos++) {
+        dst[len + i] = st->expr_pos < st->expr_out ?
+                         st->expr_buf[st->expr_pos] : ' ';
+      }
+      if (st->expr_pos == st->expr_len) {
+        st->segment++;
+        st->span_left = st->segment->length;
+        st->expr_len = -1;
+      }
+    }
+    len += n;
   }
-  // Nothing is available, lets ask for some more data
-  if (addr != -1)
-    simplefs_request_data(c_flash, addr);
-  return;
+  return len;
 }
 
-static void prepare_data(chanend c_flash, connection_state_t *st)
+// Prepare the next send of at most mss bytes. Sends that are built in
+// current_data are also bounded by WEB_SERVER_SEND_BUF_SIZE, which is a
+// full segment by default.
+static void prepare_data(chanend c_flash, connection_state_t *st, int mss)
 {
-  int getlen = st->end_of_data - st->next_data;
-  if (getlen > WEB_SERVER_SEND_BUF_SIZE)
-    getlen = WEB_SERVER_SEND_BUF_SIZE;
-
-  char *src0 = simplefs_get_data(c_flash, st->next_data, getlen);
-  char *eod = src0 + getlen;
   char *dst = st->current_data;
-  char *src = src0;
+  int max = mss < WEB_SERVER_SEND_BUF_SIZE ? mss : WEB_SERVER_SEND_BUF_SIZE;
   int len = 0;
 
-  if (!st->is_template) {
-    memcpy(dst, src, getlen);
-    st->current_data_len = getlen;
-    st->next_data += getlen;
+#if !WEB_SERVER_USE_FLASH
+  // The body of a file that is not a template is sent straight from the
+  // image in RAM, a full segment at a time. A resend takes the same
+  // range of the file again.
+  if (!st->is_template && st->next_data >= st->end_of_header) {
+    len = st->end_of_data - st->next_data;
+    if (len > mss)
+      len = mss;
+    st->send_from_file = 1;
+    st->file_data = st->next_data;
+    st->current_data_len = len;
+    st->next_data += len;
     return;
   }
+#endif
+  st->send_from_file = 0;
 
+  if (st->next_data < st->end_of_header) {
+    const char *extra = connection_headers(st);
+    int extra_len = strlen(extra);
+    int getlen = st->end_of_header - st->next_data;
+    if (getlen > max - extra_len)
+      getlen = max - extra_len;
 
-  int finished = 0;
-  while (!finished) {
-    switch (*src) {
-    case 255: {
-      int dyn_expr_id = *(src+1);
-      char buf[WEB_SERVER_SEND_BUF_SIZE];
-      int dyn_expr_len = web_server_dyn_expr(dyn_expr_id, buf,
-                                             app_state, (int) st);
+    memcpy(dst, simplefs_get_data(c_flash, st->next_data, getlen), getlen);
+    st->next_data += getlen;
+    len = getlen;
+    if (st->next_data < st->end_of_header) {
+      st->current_data_len = len;
+      return;
+    }
+    memcpy(dst + len, extra, extra_len);
+    len += extra_len;
+  }
 
-      if (dyn_expr_len > WEB_SERVER_SEND_BUF_SIZE) {
-        // Can't possibly transmit this, so skip it
-        src += 2;
-        finished = (src >= eod);
-      }
-      else if (len + dyn_expr_len > WEB_SERVER_SEND_BUF_SIZE) {
-        finished = 1;
-      }
-      else {
-        memcpy(dst, buf, dyn_expr_len);
-        src += 2;
-        dst += dyn_expr_len;
-        len += dyn_expr_len;
-        finished = (len >= WEB_SERVER_SEND_BUF_SIZE || src >= eod);
-      }
-      }
-      break;
-    default:
-      *dst = *src;
-      dst++;
-      src++;
-      len++;
-      finished = (len >= WEB_SERVER_SEND_BUF_SIZE || src >= eod);
-      break;
+  // The start of the body goes in the same segment as the end of the header
+  if (!st->chunked) {
+    len += render_body(c_flash, st, dst + len, max - len);
+  }
+  else {
+    int room = max - len - CHUNK_OVERHEAD;
+    int n = room > 0 ? render_body(c_flash, st, dst + len + CHUNK_HEADER_LEN,
+                                   room) : 0;
+    // An empty chunk would end the body
+    if (n > 0) {
+      for (int i = 0; i < 4; i++)
+        dst[len + i] = "0123456789abcdef"[(n >> (12 - 4*i)) & 0xf];
+      dst[len + 4] = 13;
+      dst[len + 5] = 10;
+      len += CHUNK_HEADER_LEN + n;
+      dst[len++] = 13;
+      dst[len++] = 10;
+    }
+    if (body_done(st) && len + 5 <= max) {
+      memcpy(dst + len, "0\r\n\r\n", 5);
+      len += 5;
+      st->chunk_end_pending = 0;
     }
   }
 
   st->current_data_len = len;
-  st->next_data += (src - src0);
+}
+
+static void send_data(chanend c_xtcp, chanend c_flash, connection_state_t *st)
+{
+  if (st->send_from_file)
+    xtcp_send(c_xtcp,
+              simplefs_get_data(c_flash, st->file_data, st->current_data_len),
+              st->current_data_len);
+  else
+    xtcp_send(c_xtcp, st->current_data, st->current_data_len);
 }
 
 void web_server_handle_event(chanend c_xtcp,
@@ -483,39 +1116,72 @@ void web_server_handle_event(chanend c_xtcp,
 
   if (conn->local_port == WEB_SERVER_PORT) {
     connection_state_t *st = (connection_state_t *) conn->appstate;
+    // The state may have been handed on to a newer connection
+    if (st && st->conn_id != conn->id)
+      st = NULL;
     switch (conn->event)
       {
       case XTCP_NEW_CONNECTION:
-        st = get_new_state();
+        st = get_new_state(c_xtcp);
         if (st) {
           st->conn_id = conn->id;
           xtcp_set_connection_appstate(c_xtcp, conn, (unsigned) st);
+          #if WEB_SERVER_KEEP_ALIVE_TIMEOUT
+          xtcp_set_poll_interval(c_xtcp, conn, WEB_SERVER_KEEP_ALIVE_TIMEOUT/2);
+          #endif
         }
         else
           xtcp_abort(c_xtcp, conn);
         break;
       case XTCP_RECV_DATA: {
         int len = xtcp_recv(c_xtcp, inbuf);
-        if (st)
-          parse_http_request(c_xtcp, conn, st, inbuf, len);
+        if (st) {
+          int n = 0;
+          st->idle = 0;
+          if (st->parsing_state != PARSING_IDLE)
+            n = parse_http_request(c_xtcp, conn, st, inbuf, len);
+          hold_request_data(st, inbuf + n, len - n);
+        }
+        }
+        break;
+      case XTCP_POLL:
+        // Close a connection that has been waiting for a request for
+        // two polls in a row
+        if (st && st->active && st->parsing_state != PARSING_IDLE) {
+          if (st->idle) {
+            xtcp_close(c_xtcp, conn);
+            st->active = 0;
+          }
+          st->idle = 1;
         }
         break;
       case XTCP_REQUEST_DATA:
       case XTCP_SENT_DATA:
+        if (st)
+          st->idle = 0;
         if (!st || !st->active) {
           xtcp_complete_send(c_xtcp);
         }
-        else if (st->next_data >= st->end_of_data) {
+        else if (st->status) {
+          // The response was prepared when the request ended
+          st->status = 0;
+          send_data(c_xtcp, c_flash, st);
+        }
+        else if (body_done(st) && !st->chunk_end_pending) {
           xtcp_complete_send(c_xtcp);
-          xtcp_close(c_xtcp, conn);
-          st->active = 0;
+          if (st->keep_alive)
+            next_request(c_xtcp, conn, st);
+          else {
+            xtcp_close(c_xtcp, conn);
+            st->active = 0;
+          }
         }
         else {
           if (simplefs_data_available(c_flash,
                                       st->next_data,
-                                      WEB_SERVER_SEND_BUF_SIZE)) {
-            prepare_data(c_flash, st);
-            xtcp_send(c_xtcp, st->current_data, st->current_data_len);
+                                      send_data_len(st))) {
+            prepare_data(c_flash, st, conn->mss);
+            send_data(c_xtcp, c_flash, st);
             #ifdef WEB_SERVER_POST_RENDER_FUNCTION
             WEB_SERVER_POST_RENDER_FUNCTION((int) app_state, (int) st);
             #endif
@@ -530,7 +1196,10 @@ void web_server_handle_event(chanend c_xtcp,
         }
         break;
       case XTCP_RESEND_DATA:
-        xtcp_send(c_xtcp, st->current_data, st->current_data_len);
+        if (st)
+          send_data(c_xtcp, c_flash, st);
+        else
+          xtcp_complete_send(c_xtcp);
         break;
       case XTCP_CLOSED:
       case XTCP_ABORTED:
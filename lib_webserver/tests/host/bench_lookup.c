@@ -0,0 +1,95 @@
+// Host benchmark of simplefs_get_file().
+//
+// Built against a file system generated by makefs.py with a given
+// number of files spread over subdirectories. Every path in the image
+// and a path that is not in it are looked up in turn. The time per
+// lookup is reported for the hash table and for the directory tree walk
+// that it replaced.
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "simplefs.h"
+
+extern fs_dir_t *root;
+extern fs_path_t fs_paths[];
+extern unsigned fs_paths_mask;
+
+#define LOOKUPS 2000000
+#define MAX_FILES 4096
+
+// The lookup that simplefs_get_file() replaced
+static file_handle_t tree_get_file(const char path[])
+{
+  fs_dir_t *node = root;
+
+  while (1) {
+    if (*path == '/')
+      path++;
+
+    for (fs_file_t *file = node->files; file != NULL; file = file->next) {
+      if (strcmp(path, file->name) == 0)
+        return (file_handle_t) file;
+    }
+
+    fs_dir_t *dir = node->children;
+    for (; dir != NULL; dir = dir->next) {
+      if (strstr(path, dir->name) == path) {
+        path += strlen(dir->name);
+        node = dir;
+        break;
+      }
+    }
+
+    if (dir)
+      continue;
+
+    return NULL;
+  }
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char paths[MAX_FILES + 1][160];
+static int npaths;
+static volatile file_handle_t sink;
+
+static double time_lookups(file_handle_t (*get_file)(const char[]))
+{
+  double t = now();
+  for (int i = 0; i < LOOKUPS; i++)
+    sink = get_file(paths[i % (npaths + 1)]);
+  return (now() - t) * 1e9 / LOOKUPS;
+}
+
+int main(void)
+{
+  for (unsigned i = 0; i <= fs_paths_mask; i++) {
+    if (fs_paths[i].file && npaths < MAX_FILES)
+      snprintf(paths[npaths++], sizeof(paths[0]), "/%s", fs_paths[i].path);
+  }
+  // One lookup in each round misses
+  strcpy(paths[npaths], "/no/such/file.html");
+
+  for (int i = 0; i < npaths; i++) {
+    // The tree walk is not checked: it takes a directory whose name is a
+    // prefix of the one in the path, e.g. dir2 for dir23/
+    if (simplefs_get_file(paths[i]) == INVALID_FILE) {
+      printf("FAIL: %s not found\n", paths[i]);
+      return 1;
+    }
+  }
+  if (simplefs_get_file(paths[npaths]) != INVALID_FILE) {
+    printf("FAIL: %s found\n", paths[npaths]);
+    return 1;
+  }
+
+  printf("%5d files, %5u slots: hash %6.1f ns/lookup, tree walk %8.1f ns/lookup\n",
+         npaths, fs_paths_mask + 1,
+         time_lookups(simplefs_get_file), time_lookups(tree_get_file));
+  return 0;
+}
@@ -0,0 +1,17 @@
+#!/bin/sh
+# usage: mksite.sh <files> <dir>
+# Create a web tree of small pages, sixteen to a directory. It is built
+# as a flash image so that makefs.py gives file data addresses as
+# offsets rather than pointers, which do not fit in a simplefs_addr_t on
+# a 64-bit host.
+n=$1
+dir=$2
+rm -rf "$dir"
+mkdir -p "$dir"
+printf '[Webserver]\nuse_flash = true\n' > "$dir/webserver.conf"
+i=0
+while [ $i -lt $n ]; do
+  mkdir -p "$dir/dir$((i / 16))"
+  echo "<html><body>page $i</body></html>" > "$dir/dir$((i / 16))/page$i.html"
+  i=$((i + 1))
+done
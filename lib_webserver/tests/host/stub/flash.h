@@ -0,0 +1,9 @@
+/* Host build stand-in for the flash library. Only the types are used
+   when the file system is in RAM. */
+#ifndef FLASH_HOST_STUB_H_
+#define FLASH_HOST_STUB_H_
+
+typedef struct fl_SPIPorts { int unused; } fl_SPIPorts;
+typedef int fl_DeviceSpec;
+
+#endif
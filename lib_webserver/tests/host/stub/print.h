@@ -0,0 +1,2 @@
+/* Host build stand-in: nothing from this header is used by the code
+   under test. */
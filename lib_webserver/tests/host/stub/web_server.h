@@ -0,0 +1,8 @@
+/* Host build stand-in for web_server.h, which the generated file system
+   includes. It pulls in the xtcp API, which a lookup does not need. */
+#ifndef WEB_SERVER_HOST_STUB_H_
+#define WEB_SERVER_HOST_STUB_H_
+
+#include "simplefs.h"
+
+#endif
@@ -0,0 +1,92 @@
+// Host test of flash cache pinning with a separate flash task.
+//
+// Blocks are fetched the way the web server does it: a line is claimed
+// by simplefs_request_data() and filled when the flash task responds.
+// Pinned lines must be left alone by fetches and read ahead, a fetch
+// into a set that is all pinned must be refused, and only a range that
+// is wholly cached may be pinned.
+#include <stdio.h>
+#include "simplefs.h"
+
+extern simplefs_state_t simplefs_state;
+
+#define BLOCK WEB_SERVER_FLASH_CACHE_SIZE
+// Blocks this far apart fall in the same set
+#define SET_STRIDE (BLOCK * WEB_SERVER_FLASH_CACHE_SETS)
+
+// simplefs.c looks files up in the generated table, which is not needed
+fs_path_t fs_paths[1];
+unsigned fs_paths_mask = 0;
+
+void mutual_comm_notify(chanend c, mutual_comm_state_t *mstate)
+{
+}
+
+void mutual_comm_init_state(mutual_comm_state_t *mstate)
+{
+}
+
+// What web_server_flash_handler() does with the flash task's response
+static int fetch(simplefs_addr_t addr, int prefetch)
+{
+  simplefs_state_t *st = &simplefs_state;
+  if (!simplefs_request_data(0, addr, prefetch))
+    return 0;
+  st->line_addr[st->request_line] = st->request_addr;
+  st->line_used[st->request_line] = ++st->use_count;
+  st->request_addr = -1;
+  return 1;
+}
+
+#define CHECK(c) do { if (!(c)) { \
+    printf("FAIL: line %d: %s\n", __LINE__, #c); return 1; } } while (0)
+
+int main(void)
+{
+  simplefs_init(NULL);
+
+  CHECK(WEB_SERVER_FLASH_CACHE_LINES >= WEB_SERVER_NUM_CONNECTIONS);
+
+  // Fill every way of one set
+  for (int i = 0; i < WEB_SERVER_FLASH_CACHE_WAYS; i++)
+    CHECK(fetch(i * SET_STRIDE, 0));
+
+  // Nothing in a set that is all pinned is replaced, by a fetch or by
+  // a read ahead
+  for (int i = 0; i < WEB_SERVER_FLASH_CACHE_WAYS; i++)
+    simplefs_pin_data(i * SET_STRIDE, 1);
+  CHECK(!fetch(WEB_SERVER_FLASH_CACHE_WAYS * SET_STRIDE, 0));
+  CHECK(!fetch(WEB_SERVER_FLASH_CACHE_WAYS * SET_STRIDE, 1));
+  for (int i = 0; i < WEB_SERVER_FLASH_CACHE_WAYS; i++)
+    CHECK(simplefs_data_available(0, i * SET_STRIDE, BLOCK));
+
+  // With one line left unpinned, that is the one replaced, even though
+  // the pinned one was used less recently
+  simplefs_unpin_all();
+  simplefs_pin_data(0, 1);
+  CHECK(fetch(WEB_SERVER_FLASH_CACHE_WAYS * SET_STRIDE, 1));
+  CHECK(simplefs_data_available(0, 0, BLOCK));
+
+  // A range across two blocks pins both, whatever else is fetched
+  simplefs_unpin_all();
+  CHECK(fetch(BLOCK, 0));
+  simplefs_pin_data(BLOCK - 1, 2);
+  for (int i = 1; i <= 2 * WEB_SERVER_FLASH_CACHE_WAYS; i++) {
+    fetch(i * SET_STRIDE, 1);
+    fetch(BLOCK + i * SET_STRIDE, 1);
+  }
+  CHECK(simplefs_data_available(0, BLOCK - 1, 2));
+
+  // A range whose second block is not cached pins nothing. Connections
+  // that each hold half of their next send would otherwise be able to
+  // pin every way of the set that another is waiting on.
+  simplefs_init(NULL);
+  for (int i = 0; i < WEB_SERVER_FLASH_CACHE_WAYS; i++) {
+    CHECK(fetch(i * SET_STRIDE, 0));
+    simplefs_pin_data(i * SET_STRIDE + BLOCK - 1, 2);
+  }
+  CHECK(fetch(WEB_SERVER_FLASH_CACHE_WAYS * SET_STRIDE, 0));
+
+  printf("test_cache_pin: pass\n");
+  return 0;
+}
@@ -13,6 +13,12 @@
 
 #define WEB_SERVER_NUM_FLASH_DEVICES 1
 
+// The largest send built per connection, a full TCP segment by default.
+// Headers, templates and files served from flash go out in segments of at
+// most this size. With flash this is also the size of a cache block.
+// Lower it to save RAM at the cost of smaller segments.
+// #define WEB_SERVER_SEND_BUF_SIZE 1460
+
 // Declare any functions that are used in the webpages here...
 
 
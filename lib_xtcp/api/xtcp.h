@@ -126,7 +126,11 @@ typedef enum xtcp_event_type_t {
                               is now requesting more data so the client
                               **must** follow receipt of this event
                               with a call to xtcp_send() before any other
-                              interaction with the server. */
+                              interaction with the server.
+                              When XTCP_ENABLE_TCP_SEND_WINDOW is set,
+                              this event occurs on TCP connections as
+                              soon as the previous data has been queued
+                              for sending and there is room for more. */
 
   XTCP_RESEND_DATA,    /**<  This event occurs when the server has failed to
                               send the previous piece of data that was given
@@ -135,7 +139,10 @@ typedef enum xtcp_event_type_t {
                               again. The client
                               **must** follow receipt of this event
                               with a call to xtcp_send() before any other
-                              interaction with the server. */
+                              interaction with the server.
+                              When XTCP_ENABLE_TCP_SEND_WINDOW is set,
+                              TCP data is retransmitted by the server and
+                              this event does not occur on TCP connections. */
 
   XTCP_TIMED_OUT,      /**<   This event occurs when the connection has
                               timed out with the remote host (TCP only).
@@ -422,6 +429,62 @@ void xtcp_ack_recv_mode(chanend c_xtcp,
 void xtcp_ack_recv(chanend c_xtcp,
                    REFERENCE_PARAM(xtcp_connection_t,conn));
 
+#if XTCP_ENABLE_SHARED_RECV
+/** \brief Set a connection into shared-memory receive mode.
+ *
+ *  In shared-memory receive mode the server copies received data directly
+ *  into ``buf`` and a receive event is followed by a call to
+ *  xtcp_recv_shared() which returns a pointer into the buffer rather than
+ *  streaming the data over the channel. The client must release the data
+ *  with xtcp_shared_recv_ack() once it has finished with it; the tcp window
+ *  is closed while the buffer has no room for another full packet.
+ *
+ *  The buffer is filled from the start and rewound once all the data in it
+ *  has been released, so each block of received data is contiguous and
+ *  stays where it is until it is released. It can be worked on and sent
+ *  from there without copying it out.
+ *
+ *  Only TCP connections are supported and the client must be on the same
+ *  tile as the xtcp server. ``buf`` must remain valid until the connection
+ *  is closed and ``len`` must be at least XTCP_CLIENT_BUF_SIZE.
+ *
+ * \param c_xtcp      chanend connected to the xtcp server
+ * \param conn        the connection
+ * \param buf         the receive buffer shared with the server
+ * \param len         the size of the buffer in bytes
+ */
+void xtcp_shared_recv_mode(chanend c_xtcp,
+                           REFERENCE_PARAM(xtcp_connection_t,conn),
+                           char buf[], int len);
+
+/** \brief Receive data in shared-memory receive mode.
+ *
+ *  This should be called after an XTCP_RECV_DATA event on a connection
+ *  in shared-memory receive mode instead of xtcp_recv().
+ *
+ * \param c_xtcp      chanend connected to the xtcp server
+ * \param data        set to point at the received data in the shared buffer
+ * \returns           The length of the received data in bytes
+ */
+#ifdef __XC__
+int xtcp_recv_shared(chanend c_xtcp, char * unsafe &data);
+#else
+int xtcp_recv_shared(chanend c_xtcp, char **data);
+#endif
+
+/** \brief Release data received in shared-memory receive mode.
+ *
+ *  Data is released in the order it was received.
+ *
+ * \param c_xtcp      chanend connected to the xtcp server
+ * \param conn        the connection
+ * \param len         the number of bytes to release
+ */
+void xtcp_shared_recv_ack(chanend c_xtcp,
+                          REFERENCE_PARAM(xtcp_connection_t,conn),
+                          int len);
+#endif
+
 
 /** \brief Send data to the xtcp server
  *
@@ -480,10 +543,19 @@ void xtcp_sendi(chanend c_xtcp,
                 int len);
 
 
-/** \brief Set UDP poll interval.
+/** \brief Set the poll interval of a connection.
+ *
+ *  When this is called then the connection will cause a poll event
+ *  every poll_interval milliseconds. An interval of zero stops the polls.
  *
- *  When this is called then the udp connection will cause a poll event
- *  every poll_interval milliseconds.
+ *  UDP and TCP connections can both be polled. A TCP connection is only
+ *  polled while it is established and has no unacknowledged data
+ *  outstanding; a poll that falls due while data is in flight is delivered
+ *  once that data has been acknowledged. A poll is also held back while
+ *  the connection has another event to deliver, so on a busy connection
+ *  polls can arrive later than the interval. Earlier versions ignored
+ *  this call on TCP connections, so a client that makes it for one must
+ *  now expect XTCP_POLL events on it.
  *
  * \param c_xtcp         chanend connected to the xtcp server
  * \param conn           the connection
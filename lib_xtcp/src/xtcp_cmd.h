@@ -5,6 +5,15 @@
 
 #define XTCP_CMD_TOKEN 128
 
+/* Data transfer protocol versions. A client announces the version it
+ * understands on each transfer: in the ready word of a receive and in
+ * the top bit of the length of a send. Clients that only know the
+ * original byte-per-transaction protocol keep working unchanged.
+ */
+#define XTCP_XFER_BYTES      1
+#define XTCP_XFER_WORDS      2
+#define XTCP_XFER_WORDS_FLAG 0x80000000
+
 typedef enum xtcp_cmd_t {
   XTCP_CMD_LISTEN,
   XTCP_CMD_UNLISTEN,
@@ -26,7 +35,8 @@ typedef enum xtcp_cmd_t {
   XTCP_CMD_PAUSE,
   XTCP_CMD_UNPAUSE,
   XTCP_CMD_UPDATE_BUFINFO,
-  XTCP_CMD_ACCEPT_PARTIAL_ACK
+  XTCP_CMD_ACCEPT_PARTIAL_ACK,
+  XTCP_CMD_SHARED_RECV_ACK
 } xtcp_cmd_t;
 
 #endif // _xtcp_cmd_h_
@@ -22,4 +22,44 @@
 #define XTCP_ENABLE_PUSH_FLAG_NOTIFICATION 0
 #endif
 
+#ifndef XTCP_ENABLE_SHARED_RECV
+#define XTCP_ENABLE_SHARED_RECV 0
+#endif
+
+#ifndef XTCP_ENABLE_TCP_SEND_WINDOW
+#define XTCP_ENABLE_TCP_SEND_WINDOW 0
+#endif
+
+#ifndef XTCP_ARP_TABLE_SIZE
+#define XTCP_ARP_TABLE_SIZE 32
+#endif
+
+// The number of outgoing frames that can wait for an ARP reply instead
+// of being dropped. Each takes a full frame buffer of RAM.
+#ifndef XTCP_ARP_QUEUE_LEN
+#define XTCP_ARP_QUEUE_LEN 0
+#endif
+
+#ifndef XTCP_ENABLE_TCP_OOO_QUEUE
+#define XTCP_ENABLE_TCP_OOO_QUEUE 0
+#endif
+
+#ifndef XTCP_ENABLE_DELAYED_ACK
+#define XTCP_ENABLE_DELAYED_ACK 0
+#endif
+
+#ifndef XTCP_TX_QUEUE_LEN
+#define XTCP_TX_QUEUE_LEN 2
+#endif
+
+#ifndef XTCP_ENABLE_CHECKSUM_OFFLOAD
+#define XTCP_ENABLE_CHECKSUM_OFFLOAD 0
+#endif
+
+// Set to 1 when the MAC serving ethernet_rx_if is on the same tile, so
+// that frames are processed in the MAC's buffers rather than copied in
+#ifndef XTCP_BORROW_RX_PACKETS
+#define XTCP_BORROW_RX_PACKETS 0
+#endif
+
 #endif // __xtcp_conf_derived_h__
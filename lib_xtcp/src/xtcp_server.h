@@ -28,6 +28,7 @@ void xtcpd_send_event(chanend c, xtcp_event_type_t event,
 void xtcpd_send_null_event(chanend c);
 
 void xtcpd_service_clients(chanend xtcp[], int num_xtcp);
+void xtcpd_service_client_token(chanend xtcp, int i, unsigned char tok);
 void xtcpd_service_clients_until_ready(int waiting_link,
                                        chanend xtcp[],
                                        int num_xtcp);
@@ -39,6 +40,13 @@ void xtcpd_recv(chanend xtcp[],
                 unsigned char data[],
                 int datalen);
 
+void xtcpd_recv_shared(chanend xtcp[],
+                       int linknum,
+                       int num_xtcp,
+                       REFERENCE_PARAM(xtcpd_state_t, s),
+                       unsigned data,
+                       int datalen);
+
 int xtcpd_send(chanend c,
                xtcp_event_type_t event,
                REFERENCE_PARAM(xtcpd_state_t, s),
@@ -42,4 +42,7 @@ void xtcpd_pause(int conn_id);
 void xtcpd_unpause(int conn_id);
 void xtcpd_accept_partial_ack(int conn_id);
 
+void xtcpd_shared_recv_mode(int conn_id, unsigned buf, int len);
+void xtcpd_shared_recv_ack(int conn_id, int len);
+
 #endif
@@ -167,10 +167,58 @@ typedef unsigned short uip_stats_t;
 #define UIP_CONF_STATISTICS      0
 #endif
 
+#ifdef XTCP_TCP_RECEIVE_WINDOW
+/* A window larger than the client's receive buffer is fine as long as no
+   single segment is, so the advertised MSS takes over that limit. */
+#define UIP_CONF_RECEIVE_WINDOW XTCP_TCP_RECEIVE_WINDOW
+#ifdef XTCP_MAX_RECEIVE_SIZE
+#define UIP_CONF_RECEIVE_MSS XTCP_MAX_RECEIVE_SIZE
+#endif
+#endif
+
 #if !defined(UIP_CONF_RECEIVE_WINDOW) && defined(XTCP_MAX_RECEIVE_SIZE)
 #define UIP_CONF_RECEIVE_WINDOW XTCP_MAX_RECEIVE_SIZE
 #endif
 
+#define UIP_CONF_ARPTAB_SIZE XTCP_ARP_TABLE_SIZE
+#define UIP_CONF_ARP_QUEUE_LEN XTCP_ARP_QUEUE_LEN
+
+#if XTCP_ENABLE_TCP_OOO_QUEUE
+#define UIP_CONF_TCP_OOO 1
+#ifdef XTCP_TCP_OOO_SEGMENTS
+#define UIP_CONF_TCP_OOO_SEGMENTS XTCP_TCP_OOO_SEGMENTS
+#endif
+#endif
+
+#if XTCP_ENABLE_TCP_SEND_WINDOW
+#ifdef XTCP_ENABLE_PARTIAL_PACKET_ACK
+#error "XTCP_ENABLE_TCP_SEND_WINDOW cannot be used with XTCP_ENABLE_PARTIAL_PACKET_ACK"
+#endif
+#define UIP_CONF_TCP_SEND_WINDOW 1
+#ifdef XTCP_TCP_SEND_BUFFER_SIZE
+#define UIP_CONF_TCP_SEND_BUFFER_SIZE XTCP_TCP_SEND_BUFFER_SIZE
+#endif
+#endif
+
+#ifdef XTCP_TCP_TIMER_TICK_MS
+#define UIP_CONF_TCP_TICK_MS XTCP_TCP_TIMER_TICK_MS
+#endif
+
+#ifdef XTCP_TCP_RTO_MIN_MS
+#define UIP_CONF_RTO_MIN_MS XTCP_TCP_RTO_MIN_MS
+#endif
+
+#if XTCP_ENABLE_CHECKSUM_OFFLOAD
+#define UIP_CONF_CHECKSUM_OFFLOAD 1
+#endif
+
+#if XTCP_ENABLE_DELAYED_ACK
+#define UIP_CONF_DELAYED_ACK 1
+#ifdef XTCP_TCP_DELAYED_ACK_MS
+#define UIP_CONF_DELACK_MS XTCP_TCP_DELAYED_ACK_MS
+#endif
+#endif
+
 
 #define UIP_CONF_EXTERNAL_BUFFER     1
 
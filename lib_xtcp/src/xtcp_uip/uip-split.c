@@ -63,15 +63,17 @@ extern int uip_do_split;
 static void
 uip_split_output_send(void)
 {
-	/* Recalculate the TCP checksum. */
-	BUF->tcpchksum = 0;
-	BUF->tcpchksum = ~(uip_tcpchksum());
+	if (!uip_tx_chksum_offloaded()) {
+		/* Recalculate the TCP checksum. */
+		BUF->tcpchksum = 0;
+		BUF->tcpchksum = ~(uip_tcpchksum());
 
 #if !UIP_CONF_IPV6
-	/* Recalculate the IP checksum. */
-	BUF->ipchksum = 0;
-	BUF->ipchksum = ~(uip_ipchksum());
+		/* Recalculate the IP checksum. */
+		BUF->ipchksum = 0;
+		BUF->ipchksum = ~(uip_ipchksum());
 #endif
+	}
 	uip_len += UIP_LLH_LEN;
 
 	/* Transmit the first packet. */
@@ -96,6 +98,10 @@ uip_split_output()
 	if (BUF->proto == UIP_PROTO_TCP) {
 #if UIP_SLIDING_WINDOW
           if (uip_do_split)
+#elif UIP_TCP_SEND_WINDOW
+          /* Several segments can be in flight, so there is no need to
+             split them to provoke an early ACK */
+          if (0)
 #else
           int data_len = uip_len - UIP_TCPIP_HLEN - UIP_LLH_LEN;
           if (data_len > ACTUAL_UIP_PACKET_SPLIT_THRESHOLD)
@@ -156,8 +162,10 @@ uip_split_output()
                         uip_split_output_send();
 		} else {
 			// We didn't compute the checksum earlier
-			BUF->tcpchksum = 0;
-			BUF->tcpchksum = ~(uip_tcpchksum());
+			if (!uip_tx_chksum_offloaded()) {
+				BUF->tcpchksum = 0;
+				BUF->tcpchksum = ~(uip_tcpchksum());
+			}
                         xcoredev_send();
 		}
 	} else {
@@ -163,10 +163,44 @@ u16_t uip_len, uip_slen;
  depending on the maximum packet
  size. */
 
+struct uip_txfrag uip_txfrags[UIP_TX_MAX_FRAGS];
+u8_t uip_txfrag_count;
+u16_t uip_txfrag_len; /* Bytes of uip_len held in uip_txfrags. */
+
+#if UIP_CHECKSUM_OFFLOAD
+u8_t uip_rx_chksum_ok;
+u8_t uip_tx_chksum_offload;
+#endif
+
 #if UIP_SLIDING_WINDOW
 int uip_do_split;
 #endif
 
+#if UIP_TCP_SEND_WINDOW
+/* Per-connection buffers holding sent but unacknowledged data. The
+ oldest unacknowledged byte of a connection is at offset snd_head in its
+ buffer and the buffer holds conn->len bytes. */
+static u8_t uip_sndbuf[UIP_CONNS][UIP_TCP_SEND_BUFFER_SIZE];
+
+/* Offset from snd_nxt of the segment being sent, or -1 to use the
+ sequence number of the next new byte. */
+static int uip_snd_offset;
+#endif
+
+#if UIP_DELAYED_ACK
+/* Length of the in-order data the segment being processed brought, which
+ may have its ACK delayed. Zero for anything else that sets
+ UIP_NEWDATA, such as a window update after uip_restart(). */
+static u16_t uip_delack_len;
+
+/* Forget an ACK a connection was holding back, so that it is not sent
+ once the connection has closed or its slot has been reused. */
+static void uip_delack_clear(struct uip_conn *conn) {
+	conn->delack_bytes = 0;
+	uip_twheel_cancel(&conn->delack_tmr);
+}
+#endif
+
 u32_t uip_flags; /* The uip_flags variable is used for
  communication between the TCP/IP stack
  and the application program. */
@@ -176,6 +210,52 @@ struct uip_conn *uip_conn; /* uip_conn always points to the current
 struct uip_conn uip_conns[UIP_CONNS];
 /* The uip_conns array holds all TCP
  connections. */
+
+#if UIP_CONNS > 254
+#error "UIP_CONNS must be less than 255"
+#endif
+
+/* Hash chains over the connection 4-tuple used to demultiplex incoming
+ segments. Entries are uip_conns index + 1 with 0 ending a chain. A slot
+ is moved to its new chain whenever it is reused for a new connection or
+ its local port is rebound; closed connections are left in place and
+ skipped by the lookup. */
+static u8_t uip_conn_hash[UIP_CONN_HASH_SIZE];
+static u8_t uip_conn_hnext[UIP_CONNS];
+static u8_t uip_conn_hbucket[UIP_CONNS];
+
+#define UIP_CONN_HBUCKET_NONE 0xff
+
+#if UIP_TCP_OOO
+/* Segments received ahead of rcv_nxt. A connection's segments are
+ chained in sequence order from its ooo_head, using index + 1 with 0
+ ending the chain, and never overlap. A slot with len 0 is free. */
+struct uip_ooo_seg {
+	u32_t seq;
+	u16_t len;
+	u8_t next;
+	u8_t data[UIP_RECEIVE_MSS];
+};
+
+static struct uip_ooo_seg uip_ooo[UIP_TCP_OOO_SEGMENTS];
+
+/* Sequence number of the segment most recently held, which RFC 2018
+ wants reported in the first SACK block. */
+static u32_t uip_ooo_recent;
+
+#if UIP_TCP_OOO_SEGMENTS > 254
+#error "UIP_TCP_OOO_SEGMENTS must be less than 255"
+#endif
+
+static void uip_ooo_flush(struct uip_conn *conn) {
+	while (conn->ooo_head != 0) {
+		struct uip_ooo_seg *seg = &uip_ooo[conn->ooo_head - 1];
+		conn->ooo_head = seg->next;
+		seg->len = 0;
+	}
+}
+#endif
+
 u16_t uip_listenports[UIP_LISTENPORTS];
 /* The uip_listenports list all currently
  listning ports. */
@@ -206,7 +286,7 @@ static u16_t lastport; /* Keeps track of the last port used for
 
 /* Temporary variables. */
 u8_t uip_acc32[4];
-static u8_t c, opt;
+static u8_t c;
 static u16_t tmp16;
 
 /* Structures and definitions. */
@@ -221,8 +301,15 @@ static u16_t tmp16;
 #define TCP_OPT_END     0   /* End of TCP options list */
 #define TCP_OPT_NOOP    1   /* "No-operation" TCP option */
 #define TCP_OPT_MSS     2   /* Maximum segment size TCP option */
+#define TCP_OPT_WS      3   /* Window scale TCP option */
+#define TCP_OPT_SACK_PERM 4 /* SACK permitted TCP option */
+#define TCP_OPT_SACK    5   /* SACK TCP option */
 
 #define TCP_OPT_MSS_LEN 4   /* Length of TCP MSS option. */
+#define TCP_OPT_WS_LEN  3   /* Length of TCP window scale option. */
+#define TCP_OPT_SACK_PERM_LEN 2 /* Length of TCP SACK permitted option. */
+
+#define UIP_SACK_BLOCKS 4   /* SACK blocks that fit in the TCP options. */
 
 #define ICMP_ECHO_REPLY 0
 #define ICMP_ECHO       8
@@ -300,7 +387,7 @@ static int xtcp_compare_words(const u8_t* a, const u8_t* b)
 
 
 
-#if UIP_SLIDING_WINDOW
+#if UIP_SLIDING_WINDOW || UIP_TCP_SEND_WINDOW
 static int xtcp_get_word(const u8_t *a) {
   unsigned int aw = ((*(unsigned short*)(&a[2])) << 16) + *(unsigned short*)(&a[0]);
   return byterev(aw);
@@ -334,33 +421,127 @@ int uip_ipaddr_cmp(const void *addr1, const void *addr2)
 }
 
 
-/* Alternative faster checksum computation */
+/* Checksum kernels. The one's complement sum does not depend on byte
+ order (RFC 1071), so data is summed as native words and the result is
+ byte swapped once at the end rather than once per 16 bit word. */
 
 static int onesReduce(unsigned int sum, int carry) {
     sum = (sum & 0xffff) + (sum >> 16) + carry;
     return (sum & 0xffff) + (sum >> 16);
 }
 
-static u16_t chksum(u16_t sum, const u8_t *byte_data, u16_t lengthInBytes) {
-    int i;
-    short* data = (short*)byte_data;
-    unsigned s = sum;
-    for(i = 0; i < (lengthInBytes>>1); i++) {
-        s += byterev(data[i]) >> 16;
+#define chksum_swap(x) (byterev(x) >> 16)
+
+static unsigned chksum_fold(unsigned long long s) {
+    s = (s & 0xffffffff) + (s >> 32);
+    s = (s & 0xffffffff) + (s >> 32);
+    return onesReduce((unsigned) s, 0);
+}
+
+/* The native order sum of len bytes starting at a 16 bit aligned
+ address. A trailing odd byte is the high byte of its network order
+ word, which is the low byte of the native one. */
+static unsigned chksum_native(const u8_t *p, unsigned len) {
+    unsigned long long s0 = 0, s1 = 0;
+    const unsigned *w;
+
+    if (((unsigned) p & 2) && len >= 2) {
+        s0 = *(const u16_t *) p;
+        p += 2;
+        len -= 2;
+    }
+    w = (const unsigned *) p;
+    /* Two accumulators keep neighbouring adds independent so that they
+     can issue together. */
+    for (; len >= 16; len -= 16, w += 4) {
+        s0 += w[0];
+        s1 += w[1];
+        s0 += w[2];
+        s1 += w[3];
+    }
+    for (; len >= 4; len -= 4) {
+        s0 += *w++;
+    }
+    p = (const u8_t *) w;
+    if (len >= 2) {
+        s1 += *(const u16_t *) p;
+        p += 2;
+        len -= 2;
     }
-    if (lengthInBytes & 1) {
-        s += byte_data[2*i] << 8;
+    if (len) {
+        s1 += *p;
     }
-    sum = onesReduce(s, 0);
-    return sum;
+    return chksum_fold(s0 + s1);
 }
 
+static u16_t chksum(u16_t sum, const u8_t *data, u16_t len) {
+    unsigned s;
+
+    if (((unsigned) data & 1) && len > 0) {
+        /* Summing from the next even address puts every byte in the other
+         half of its word, which swapping the partial sum puts right. */
+        s = data[0] + chksum_swap(chksum_native(data + 1, len - 1));
+    } else {
+        s = chksum_native(data, len);
+    }
+    return onesReduce(chksum_swap(onesReduce(s, 0)) + sum, 0);
+}
+
+#if UIP_TCP_SEND_WINDOW
+/* Copy len bytes and return chksum(0, src, len). When the two buffers
+ are aligned alike, whole words are moved and the data is read once.
+ Otherwise a byte at a time copy and sum costs several times more than
+ memcpy() followed by summing the copy, which is what is done. */
+static u16_t chksum_copy(u8_t *dst, const u8_t *src, u16_t len) {
+    unsigned long long s = 0, sw = 0;
+    unsigned k = 0, start;
+
+    if ((((unsigned) dst ^ (unsigned) src) & 3) != 0) {
+        memcpy(dst, src, len);
+        return chksum(0, dst, len);
+    }
+
+    for (; k < len && ((unsigned) (src + k) & 3); k++) {
+        dst[k] = src[k];
+        s += (k & 1) ? src[k] << 8 : src[k];
+    }
+    start = k;
+    for (; k + 4 <= len; k += 4) {
+        unsigned w = *(const unsigned *) (src + k);
+        *(unsigned *) (dst + k) = w;
+        sw += w;
+    }
+    /* Words that started at an odd offset have their bytes swapped. */
+    s += (start & 1) ? chksum_swap(chksum_fold(sw)) : chksum_fold(sw);
+    for (; k < len; k++) {
+        dst[k] = src[k];
+        s += (k & 1) ? src[k] << 8 : src[k];
+    }
+    return chksum_swap(chksum_fold(s));
+}
+
+/* Length and sum of the payload being sent from uip_sappdata, when it
+ was summed while being copied into the retransmit buffer. Used once by
+ the TCP checksum of the packet being built. */
+static u16_t uip_payload_len;
+static u16_t uip_payload_sum;
+
+void uip_payload_sum_clear(void) {
+	uip_payload_len = 0;
+}
+#endif
+
 
 /*---------------------------------------------------------------------------*/
 u16_t uip_chksum(u16_t *data, u16_t len) {
 	return htons(chksum(0, (u8_t *) data, len));
 }
 /*---------------------------------------------------------------------------*/
+void uip_chksum_update(u16_t *chksum, u16_t old, u16_t new) {
+	/* RFC 1624 equation 3: HC' = ~(~HC + ~m + m') */
+	*chksum = ~onesReduce((u16_t) ~*chksum + (u16_t) ~old + new, 0);
+}
+/*---------------------------------------------------------------------------*/
 #ifndef UIP_ARCH_IPCHKSUM
 u16_t uip_ipchksum(void) {
 	u16_t sum;
@@ -373,6 +554,7 @@ u16_t uip_ipchksum(void) {
 /*---------------------------------------------------------------------------*/
 static u16_t upper_layer_chksum(u8_t proto) {
 	u16_t upper_layer_len;
+	u16_t hdr_len;
 	u16_t sum;
 
 #if UIP_CONF_IPV6
@@ -389,7 +571,31 @@ static u16_t upper_layer_chksum(u8_t proto) {
 	sum = chksum(sum, (u8_t *) &BUF->srcipaddr[0], 2 * sizeof(uip_ipaddr_t));
 
 	/* Sum TCP header and data. */
-	sum = chksum(sum, &uip_buf[UIP_IPH_LEN + UIP_LLH_LEN], upper_layer_len);
+	hdr_len = upper_layer_len - uip_txfrag_len;
+#if UIP_TCP_SEND_WINDOW
+	if (uip_payload_len != 0 && proto == UIP_PROTO_TCP &&
+			uip_payload_len + ((BUF->tcpoffset >> 4) << 2) == hdr_len) {
+		/* The payload was summed when it was copied. */
+		hdr_len -= uip_payload_len;
+		sum = onesReduce(sum + ((hdr_len & 1) ? chksum_swap(uip_payload_sum)
+				: uip_payload_sum), 0);
+		uip_payload_len = 0;
+	}
+#endif
+	sum = chksum(sum, &uip_buf[UIP_IPH_LEN + UIP_LLH_LEN], hdr_len);
+
+	/* Sum any payload that is sent from outside uip_buf. A fragment
+	 that follows an odd number of bytes has its sum byte swapped. */
+	if (uip_txfrag_count) {
+		unsigned s = sum;
+		int odd = hdr_len & 1;
+		for (int i = 0; i < uip_txfrag_count; i++) {
+			u16_t fsum = chksum(0, uip_txfrags[i].data, uip_txfrags[i].len);
+			s += odd ? chksum_swap(fsum) : fsum;
+			odd ^= uip_txfrags[i].len & 1;
+		}
+		sum = onesReduce(s, 0);
+	}
 
 	return (sum == 0) ? 0xffff : htons(sum);
 }
@@ -420,6 +626,8 @@ void uip_init(void) {
 	memset(uip_listenports, 0, sizeof(uip_listenports));
 	memset(uip_udp_listenports, 0, sizeof(uip_listenports));
 	memset(uip_conns, 0, sizeof(uip_conns));
+	memset(uip_conn_hash, 0, sizeof(uip_conn_hash));
+	memset(uip_conn_hbucket, UIP_CONN_HBUCKET_NONE, sizeof(uip_conn_hbucket));
 #if UIP_ACTIVE_OPEN
 	lastport = 1024;
 #endif /* UIP_ACTIVE_OPEN */
@@ -429,6 +637,36 @@ void uip_init(void) {
 #endif /* UIP_UDP */
 }
 
+/*---------------------------------------------------------------------------*/
+static u8_t uip_conn_hashfn(u16_t lport, u16_t rport, const u16_t *ripaddr) {
+	u16_t h = lport ^ rport ^ ripaddr[0] ^ ripaddr[1];
+	return (h ^ (h >> 8)) & (UIP_CONN_HASH_SIZE - 1);
+}
+
+void uip_conn_hash_remove(struct uip_conn *conn) {
+	u8_t idx = conn - uip_conns;
+	u8_t bucket = uip_conn_hbucket[idx];
+
+	if (bucket != UIP_CONN_HBUCKET_NONE) {
+		u8_t *p = &uip_conn_hash[bucket];
+		while (*p != idx + 1) {
+			p = &uip_conn_hnext[*p - 1];
+		}
+		*p = uip_conn_hnext[idx];
+		uip_conn_hbucket[idx] = UIP_CONN_HBUCKET_NONE;
+	}
+}
+
+void uip_conn_hash_insert(struct uip_conn *conn) {
+	u8_t idx = conn - uip_conns;
+	u8_t bucket;
+
+	uip_conn_hash_remove(conn);
+	bucket = uip_conn_hashfn(conn->lport, conn->rport, conn->ripaddr);
+	uip_conn_hnext[idx] = uip_conn_hash[bucket];
+	uip_conn_hash[bucket] = idx + 1;
+	uip_conn_hbucket[idx] = bucket;
+}
 /*---------------------------------------------------------------------------*/
 #if UIP_ACTIVE_OPEN
 struct uip_conn *
@@ -487,12 +725,26 @@ uip_connect(uip_ipaddr_t *ripaddr, u16_t rport)
 	conn->timer = 1; /* Send the SYN next time around. */
 	conn->rto = UIP_RTO;
 	conn->sa = 0;
-	conn->sv = 16; /* Initial value of the RTT variance. */
+	conn->sv = UIP_TCP_TICKS(1600); /* Initial value of the RTT variance. */
 	conn->lport = htons(lastport);
 	conn->rport = rport;
 	uip_ipaddr_copy(&conn->ripaddr, ripaddr);
+	uip_conn_hash_insert(conn);
 #if UIP_SLIDING_WINDOW
         conn->midpoint = 0;
+#endif
+#if UIP_TCP_SEND_WINDOW
+	conn->snd_wnd = 0;
+	conn->snd_head = 0;
+	conn->snd_unsent = 0;
+	conn->dupacks = 0;
+	conn->fin_pending = 0;
+#endif
+#if UIP_TCP_OOO
+	uip_ooo_flush(conn);
+#endif
+#if UIP_DELAYED_ACK
+	uip_delack_clear(conn);
 #endif
 	return conn;
 }
@@ -723,8 +975,310 @@ static void uip_add_rcv_nxt(u16_t n) {
 	xtcp_copy_word(uip_conn->rcv_nxt, uip_acc32);
 }
 /*---------------------------------------------------------------------------*/
+/* Parse the options of a SYN or SYNACK from the remote host. */
+static void uip_parse_synopts(struct uip_conn *conn) {
+	u8_t *opts = &uip_buf[UIP_TCPIP_HLEN + UIP_LLH_LEN];
+	u16_t optlen = ((BUF->tcpoffset >> 4) - 5) << 2;
+	u16_t i;
+
+#if UIP_TCP_OOO
+	conn->sack_ok = 0;
+#endif
+#if UIP_RCV_WSCALE
+	conn->snd_wscale = conn->rcv_wscale = 0;
+#endif
+	for (i = 0; i < optlen;) {
+		if (opts[i] == TCP_OPT_END) {
+			/* End of options. */
+			break;
+		} else if (opts[i] == TCP_OPT_NOOP) {
+			/* NOP option. */
+			++i;
+			continue;
+		}
+		/* All other options have a length field, so that we easily can
+		 skip past them. If it is too short, or runs past the end of the
+		 options, the options are malformed and we don't process them
+		 further. An option is only read if its length is the one
+		 expected for it. */
+		if (i + 1 >= optlen || opts[i + 1] < 2 || i + opts[i + 1] > optlen) {
+			break;
+		}
+		if (opts[i] == TCP_OPT_MSS && opts[i + 1] == TCP_OPT_MSS_LEN) {
+			u16_t mss = ((u16_t) opts[i + 2] << 8) | opts[i + 3];
+			conn->initialmss = conn->mss = mss > UIP_TCP_MSS ? UIP_TCP_MSS : mss;
+		}
+#if UIP_RCV_WSCALE
+		else if (opts[i] == TCP_OPT_WS && opts[i + 1] == TCP_OPT_WS_LEN) {
+			conn->snd_wscale = opts[i + 2] > 14 ? 14 : opts[i + 2];
+			conn->rcv_wscale = UIP_RCV_WSCALE;
+		}
+#endif
+#if UIP_TCP_OOO
+		else if (opts[i] == TCP_OPT_SACK_PERM &&
+				opts[i + 1] == TCP_OPT_SACK_PERM_LEN) {
+			conn->sack_ok = 1;
+		}
+#endif
+		i += opts[i + 1];
+	}
+}
+
+#if UIP_TCP_OOO || UIP_RCV_WSCALE
+/* Add window scaling and SACK permitted after the MSS option of a SYN, or
+ of a SYNACK if the SYN had them. Returns the number of bytes added. */
+static u8_t uip_synopts(struct uip_conn *conn) {
+	int syn = (conn->tcpstateflags & UIP_TS_MASK) == UIP_SYN_SENT;
+	u8_t *opts;
+	u8_t len = 0;
+
+	/* A SYN received in place may only have room for the MSS option. */
+	uip_buf_own();
+	opts = &uip_buf[UIP_LLH_LEN + UIP_IPTCPH_LEN + TCP_OPT_MSS_LEN];
+#if UIP_RCV_WSCALE
+	if (syn || conn->rcv_wscale) {
+		opts[len++] = TCP_OPT_NOOP;
+		opts[len++] = TCP_OPT_WS;
+		opts[len++] = TCP_OPT_WS_LEN;
+		opts[len++] = UIP_RCV_WSCALE;
+	}
+#endif
+#if UIP_TCP_OOO
+	if (syn || conn->sack_ok) {
+		opts[len++] = TCP_OPT_NOOP;
+		opts[len++] = TCP_OPT_NOOP;
+		opts[len++] = TCP_OPT_SACK_PERM;
+		opts[len++] = TCP_OPT_SACK_PERM_LEN;
+	}
+#endif
+	return len;
+}
+#endif
+
+#if UIP_RCV_WSCALE
+/* The window advertised by the segment being processed, in bytes but
+ limited to 16 bits. */
+static u16_t uip_peer_wnd(struct uip_conn *conn) {
+	u32_t wnd = ((u16_t)BUF->wnd[0] << 8) + (u16_t)BUF->wnd[1];
+	if (!(BUF->flags & TCP_SYN)) {
+		wnd <<= conn->snd_wscale;
+	}
+	return wnd > 0xffff ? 0xffff : wnd;
+}
+#else
+#define uip_peer_wnd(conn) (((u16_t)BUF->wnd[0] << 8) + (u16_t)BUF->wnd[1])
+#endif
+/*---------------------------------------------------------------------------*/
+#if UIP_TCP_OOO
+/* Hold on to the data of a segment that arrived ahead of rcv_nxt. A
+ segment that overlaps one already held is dropped, and when the pool is
+ full the highest segment of the connection makes way for a lower one,
+ which is closer to being delivered. */
+static void uip_ooo_insert(struct uip_conn *conn) {
+	u32_t seq = xtcp_get_word(BUF->seqno);
+	int offset = seq - (u32_t) xtcp_get_word(conn->rcv_nxt);
+	struct uip_ooo_seg *seg;
+	u8_t *link;
+	u8_t i;
+
+	if ((conn->tcpstateflags & UIP_TS_MASK) != UIP_ESTABLISHED ||
+			(conn->tcpstateflags & UIP_STOPPED) ||
+			(BUF->flags & (TCP_SYN | TCP_FIN | TCP_URG)) ||
+			uip_len == 0 || uip_len > UIP_RECEIVE_MSS ||
+			offset <= 0 || offset + uip_len > UIP_RECEIVE_WINDOW) {
+		return;
+	}
+
+	for (link = &conn->ooo_head; *link != 0; link = &seg->next) {
+		seg = &uip_ooo[*link - 1];
+		offset = seg->seq - seq;
+		if (offset >= (int) uip_len) {
+			break;
+		}
+		if (offset + seg->len > 0) {
+			return;
+		}
+	}
+
+	for (i = 0; i < UIP_TCP_OOO_SEGMENTS && uip_ooo[i].len != 0; ++i)
+		;
+	if (i == UIP_TCP_OOO_SEGMENTS) {
+		u8_t *last;
+		if (*link == 0) {
+			return;
+		}
+		for (last = link; uip_ooo[*last - 1].next != 0;
+				last = &uip_ooo[*last - 1].next)
+			;
+		i = *last - 1;
+		*last = 0;
+	}
+
+	seg = &uip_ooo[i];
+	seg->seq = seq;
+	seg->len = uip_len;
+	memcpy(seg->data, uip_appdata, uip_len);
+	seg->next = *link;
+	*link = i + 1;
+	uip_ooo_recent = seq;
+}
+
+/* Pass the application any held segments that rcv_nxt has caught up
+ with, each as a separate UIP_NEWDATA call. */
+static void uip_ooo_deliver(struct uip_conn *conn) {
+	u32_t flags = uip_flags;
+	void *appdata = uip_appdata;
+
+	while (conn->ooo_head != 0 &&
+			(conn->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED &&
+			!(conn->tcpstateflags & UIP_STOPPED)) {
+		struct uip_ooo_seg *seg = &uip_ooo[conn->ooo_head - 1];
+		int skip = (u32_t) xtcp_get_word(conn->rcv_nxt) - seg->seq;
+
+		if (skip < 0) {
+			break;
+		}
+		conn->ooo_head = seg->next;
+		if (skip < seg->len) {
+			uip_flags = UIP_NEWDATA;
+			uip_appdata = &seg->data[skip];
+			uip_len = seg->len - skip;
+			uip_add_rcv_nxt(uip_len);
+			UIP_APPCALL();
+			flags |= UIP_NEWDATA;
+		}
+		seg->len = 0;
+	}
+	uip_flags = flags;
+	uip_appdata = appdata;
+}
+
+static void uip_put32(u8_t *p, u32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* Write a SACK option after the TCP header describing the held segments,
+ the block with the most recent one first. Returns its length. */
+static u8_t uip_sack_option(struct uip_conn *conn) {
+	u32_t left[UIP_SACK_BLOCKS], right[UIP_SACK_BLOCKS];
+	u8_t n = 0, first = 0, len = 4;
+	u8_t *opts;
+	u8_t i;
+
+	for (i = conn->ooo_head; i != 0; i = uip_ooo[i - 1].next) {
+		struct uip_ooo_seg *seg = &uip_ooo[i - 1];
+		if (n > 0 && right[n - 1] == seg->seq) {
+			right[n - 1] += seg->len;
+		} else if (n < UIP_SACK_BLOCKS) {
+			left[n] = seg->seq;
+			right[n] = seg->seq + seg->len;
+			++n;
+		} else {
+			break;
+		}
+		if (seg->seq == uip_ooo_recent) {
+			first = n - 1;
+		}
+	}
+
+	/* The segment being acknowledged may be too short to hold it. */
+	uip_buf_own();
+	opts = &uip_buf[UIP_LLH_LEN + UIP_IPTCPH_LEN];
+	opts[0] = TCP_OPT_NOOP;
+	opts[1] = TCP_OPT_NOOP;
+	opts[2] = TCP_OPT_SACK;
+	opts[3] = 2 + 8 * n;
+	for (i = 0; i < n; ++i) {
+		u8_t b = i == 0 ? first : (i - 1 < first ? i - 1 : i);
+		uip_put32(&opts[len], left[b]);
+		uip_put32(&opts[len + 4], right[b]);
+		len += 8;
+	}
+	return len;
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#if UIP_TCP_SEND_WINDOW
+/* Copy len bytes of data into a connection's retransmit buffer, offset
+ bytes after its oldest unacknowledged byte. */
+static u16_t uip_sndbuf_copy(struct uip_conn *conn, u16_t offset,
+		u8_t *data, u16_t len) {
+	u8_t *buf = uip_sndbuf[conn - uip_conns];
+	unsigned pos = conn->snd_head + offset;
+	u16_t n, sum, sum2;
+
+	if (pos >= UIP_TCP_SEND_BUFFER_SIZE) {
+		pos -= UIP_TCP_SEND_BUFFER_SIZE;
+	}
+	n = UIP_TCP_SEND_BUFFER_SIZE - pos;
+	if (n > len) {
+		n = len;
+	}
+	sum = chksum_copy(&buf[pos], data, n);
+	sum2 = chksum_copy(buf, data + n, len - n);
+	return onesReduce(sum + ((n & 1) ? chksum_swap(sum2) : sum2), 0);
+}
+
+/* Send len bytes of a connection's retransmit buffer, offset bytes after
+ its oldest unacknowledged byte, as the payload of the packet being built
+ without copying them into uip_buf. */
+static void uip_sndbuf_frags(struct uip_conn *conn, u16_t offset, u16_t len) {
+	u8_t *buf = uip_sndbuf[conn - uip_conns];
+	unsigned pos = conn->snd_head + offset;
+	u16_t n;
+
+	if (pos >= UIP_TCP_SEND_BUFFER_SIZE) {
+		pos -= UIP_TCP_SEND_BUFFER_SIZE;
+	}
+	n = UIP_TCP_SEND_BUFFER_SIZE - pos;
+	if (n > len) {
+		n = len;
+	}
+	uip_txfrags[0].data = &buf[pos];
+	uip_txfrags[0].len = n;
+	uip_txfrags[1].data = buf;
+	uip_txfrags[1].len = len - n;
+	uip_txfrag_count = (n == len) ? 1 : 2;
+	uip_txfrag_len = len;
+}
+
+/* The amount of data that the remote host's window lets out now. */
+static u16_t uip_tcp_window_space(struct uip_conn *conn) {
+	u16_t wnd = conn->snd_wnd;
+
+	if (wnd > UIP_TCP_SEND_BUFFER_SIZE) {
+		wnd = UIP_TCP_SEND_BUFFER_SIZE;
+	}
+	/* Allow a single segment into a zero window so that it acts as a
+	 window probe, as the stop-and-wait sender does. */
+	if (wnd == 0 && conn->len == 0) {
+		wnd = conn->initialmss;
+	}
+	if (conn->len >= wnd) {
+		return 0;
+	}
+	wnd -= conn->len;
+	return wnd < conn->initialmss ? wnd : conn->initialmss;
+}
+
+u16_t uip_tcp_send_space(struct uip_conn *conn) {
+	/* Unsent data goes out before the application is asked for more,
+	 and nothing more is taken once the application has closed. */
+	if (conn->snd_unsent != 0 || conn->fin_pending) {
+		return 0;
+	}
+	return uip_tcp_window_space(conn);
+}
+#endif
+/*---------------------------------------------------------------------------*/
 
 void xtcpd_init_send_from_uip(struct uip_conn *conn);
+#if UIP_TCP_SEND_WINDOW
+void xtcpd_send_credit_from_uip(struct uip_conn *conn);
+#endif
 
 void uip_process(u8_t flag) {
 	register struct uip_conn *uip_connr = uip_conn;
@@ -734,6 +1288,14 @@ void uip_process(u8_t flag) {
         uip_do_split = 0;
         uip_slen = 0;
         #endif
+#if UIP_TCP_SEND_WINDOW
+	uip_snd_offset = -1;
+	uip_payload_len = 0;
+#endif
+	uip_txfrag_clear();
+#if UIP_DELAYED_ACK
+	uip_delack_len = 0;
+#endif
 
 
 #if UIP_UDP
@@ -750,6 +1312,8 @@ void uip_process(u8_t flag) {
 		if ((uip_connr->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED
                     #if UIP_SLIDING_WINDOW
                     && ((!uip_outstanding(uip_connr)) || uip_connr->midpoint)
+                    #elif UIP_TCP_SEND_WINDOW
+                    && uip_tcp_send_space(uip_connr) > 0
                     #else
                     && !uip_outstanding(uip_connr)
                     #endif
@@ -762,6 +1326,17 @@ void uip_process(u8_t flag) {
 		}
 		goto drop;
 
+#if UIP_DELAYED_ACK
+		/* The delayed ACK timer has fired and nothing else has carried
+		 the ACK in the meantime. */
+	} else if (flag == UIP_DELACK_TIMER) {
+		if ((uip_connr->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED
+				&& uip_connr->delack_bytes != 0) {
+			goto tcp_send_ack;
+		}
+		goto drop;
+#endif
+
 		/* Check if we were invoked because of the perodic timer fireing. */
 	} else if (flag == UIP_TIMER) {
 #if UIP_REASSEMBLY
@@ -785,6 +1360,9 @@ void uip_process(u8_t flag) {
 			++(uip_connr->timer);
 			if (uip_connr->timer == UIP_TIME_WAIT_TIMEOUT) {
 				uip_connr->tcpstateflags = UIP_CLOSED;
+#if UIP_DELAYED_ACK
+				uip_delack_clear(uip_connr);
+#endif
 			}
 		} else if (uip_connr->tcpstateflags != UIP_CLOSED) {
 			/* If the connection has outstanding data, we increase the
@@ -797,6 +1375,12 @@ void uip_process(u8_t flag) {
 									|| uip_connr->tcpstateflags == UIP_SYN_RCVD)
 									&& uip_connr->nrtx == UIP_MAXSYNRTX)) {
 						uip_connr->tcpstateflags = UIP_CLOSED;
+#if UIP_TCP_OOO
+						uip_ooo_flush(uip_connr);
+#endif
+#if UIP_DELAYED_ACK
+						uip_delack_clear(uip_connr);
+#endif
 
 						/* We call UIP_APPCALL() with uip_flags set to
 						 UIP_TIMEDOUT to inform the application that the
@@ -835,6 +1419,12 @@ void uip_process(u8_t flag) {
 #endif /* UIP_ACTIVE_OPEN */
 
 					case UIP_ESTABLISHED:
+#if UIP_TCP_SEND_WINDOW
+						/* The unacknowledged data is still in the
+						 retransmit buffer so the application is not
+						 involved. */
+						goto tcp_rexmit_buffered;
+#else
 						/* In the ESTABLISHED state, we call upon the application
 						 to do the actual retransmit after which we jump into
 						 the code for sending out the packet (the apprexmit
@@ -842,6 +1432,7 @@ void uip_process(u8_t flag) {
 						uip_flags = UIP_REXMIT;
 						UIP_APPCALL();
 						goto apprexmit;
+#endif
 
 					case UIP_FIN_WAIT_1:
 					case UIP_CLOSING:
@@ -1015,7 +1606,8 @@ void uip_process(u8_t flag) {
 	}
 
 #if !UIP_CONF_IPV6
-	if (uip_ipchksum() != 0xffff) { /* Compute and check the IP header
+	if (!uip_rx_chksum_verified(UIP_RX_IPCHKSUM_OK) &&
+			uip_ipchksum() != 0xffff) { /* Compute and check the IP header
 	 checksum. */
 		UIP_STAT(++uip_stat.ip.drop); UIP_STAT(++uip_stat.ip.chkerr); UIP_LOG("ip: bad checksum.");
 		goto drop;
@@ -1075,11 +1667,8 @@ void uip_process(u8_t flag) {
 
 	ICMPBUF->type = ICMP_ECHO_REPLY;
 
-	if (ICMPBUF->icmpchksum >= HTONS(0xffff - (ICMP_ECHO << 8))) {
-		ICMPBUF->icmpchksum += HTONS(ICMP_ECHO << 8) + 1;
-	} else {
-		ICMPBUF->icmpchksum += HTONS(ICMP_ECHO << 8);
-	}
+	uip_chksum_update(&ICMPBUF->icmpchksum, HTONS(ICMP_ECHO << 8),
+			HTONS(ICMP_ECHO_REPLY << 8));
 
 	/* Swap IP addresses. */
 	uip_ipaddr_copy(BUF->destipaddr, BUF->srcipaddr);
@@ -1169,7 +1758,8 @@ void uip_process(u8_t flag) {
 #if UIP_UDP_CHECKSUMS
 	uip_len = uip_len - UIP_IPUDPH_LEN;
 	uip_appdata = &uip_buf[UIP_LLH_LEN + UIP_IPUDPH_LEN];
-	if(UDPBUF->udpchksum != 0 && uip_udpchksum() != 0xffff) {
+	if(UDPBUF->udpchksum != 0 && !uip_rx_chksum_verified(UIP_RX_L4CHKSUM_OK) &&
+			uip_udpchksum() != 0xffff) {
 		UIP_STAT(++uip_stat.udp.drop);
 		UIP_STAT(++uip_stat.udp.chkerr);
 		UIP_LOG("udp: bad checksum.");
@@ -1284,9 +1874,11 @@ void uip_process(u8_t flag) {
 
 #if UIP_UDP_CHECKSUMS
 	/* Calculate UDP checksum. */
-	UDPBUF->udpchksum = ~(uip_udpchksum());
-	if(UDPBUF->udpchksum == 0) {
-		UDPBUF->udpchksum = 0xffff;
+	if (!uip_tx_chksum_offloaded()) {
+		UDPBUF->udpchksum = ~(uip_udpchksum());
+		if(UDPBUF->udpchksum == 0) {
+			UDPBUF->udpchksum = 0xffff;
+		}
 	}
 #endif /* UIP_UDP_CHECKSUMS */
 
@@ -1298,20 +1890,31 @@ void uip_process(u8_t flag) {
 
 	/* Start of TCP input header processing code. */
 
-	if (uip_tcpchksum() != 0xffff) { /* Compute and check the TCP
+	if (!uip_rx_chksum_verified(UIP_RX_L4CHKSUM_OK) &&
+			uip_tcpchksum() != 0xffff) { /* Compute and check the TCP
 	 checksum. */
 		UIP_STAT(++uip_stat.tcp.drop); UIP_STAT(++uip_stat.tcp.chkerr); UIP_LOG("tcp: bad checksum.");
 		goto drop;
 	}
 
+	/* The TCP header, options included, must be within the segment. */
+	if ((BUF->tcpoffset >> 4) < UIP_TCPH_LEN / 4 ||
+			((BUF->tcpoffset >> 4) << 2) + UIP_IPH_LEN > uip_len) {
+		UIP_STAT(++uip_stat.tcp.drop); UIP_LOG("tcp: bad header length.");
+		goto drop;
+	}
+
 	/* Demultiplex this segment. */
 	/* First check any active connections. */
-	for (uip_connr = &uip_conns[0]; uip_connr <= &uip_conns[UIP_CONNS - 1]; ++uip_connr) {
+	c = uip_conn_hash[uip_conn_hashfn(BUF->destport, BUF->srcport, BUF->srcipaddr)];
+	while (c != 0) {
+		uip_connr = &uip_conns[c - 1];
 		if (uip_connr->tcpstateflags != UIP_CLOSED && BUF->destport
 				== uip_connr->lport && BUF->srcport == uip_connr->rport
 				&& uip_ipaddr_cmp(BUF->srcipaddr, uip_connr->ripaddr)) {
 			goto found;
 		}
+		c = uip_conn_hnext[c - 1];
 	}
 
 	/* If we didn't find and active connection that expected the packet,
@@ -1400,53 +2003,36 @@ void uip_process(u8_t flag) {
 	/* Fill in the necessary fields for the new connection. */
 	uip_connr->rto = uip_connr->timer = UIP_RTO;
 	uip_connr->sa = 0;
-	uip_connr->sv = 4;
+	uip_connr->sv = UIP_TCP_TICKS(400);
 	uip_connr->nrtx = 0;
 	uip_connr->lport = BUF->destport;
 	uip_connr->rport = BUF->srcport;
 	uip_ipaddr_copy(uip_connr->ripaddr, BUF->srcipaddr);
+	uip_conn_hash_insert(uip_connr);
 	uip_connr->tcpstateflags = UIP_SYN_RCVD;
 
 	xtcp_copy_word(uip_connr->snd_nxt, iss);
 	uip_connr->len = 1;
+#if UIP_TCP_SEND_WINDOW
+	uip_connr->snd_wnd = 0;
+	uip_connr->snd_head = 0;
+	uip_connr->snd_unsent = 0;
+	uip_connr->dupacks = 0;
+	uip_connr->fin_pending = 0;
+#endif
+#if UIP_TCP_OOO
+	uip_ooo_flush(uip_connr);
+#endif
+#if UIP_DELAYED_ACK
+	uip_delack_clear(uip_connr);
+#endif
 
 	/* rcv_nxt should be the seqno from the incoming packet + 1. */
 	xtcp_copy_word(uip_connr->rcv_nxt, BUF->seqno);
 	uip_add_rcv_nxt(1);
 
-	/* Parse the TCP MSS option, if present. */
-	if ((BUF->tcpoffset & 0xf0) > 0x50) {
-		for (c = 0; c < ((BUF->tcpoffset >> 4) - 5) << 2;) {
-			opt = uip_buf[UIP_TCPIP_HLEN + UIP_LLH_LEN + c];
-			if (opt == TCP_OPT_END) {
-				/* End of options. */
-				break;
-			} else if (opt == TCP_OPT_NOOP) {
-				++c;
-				/* NOP option. */
-			} else if (opt == TCP_OPT_MSS && uip_buf[UIP_TCPIP_HLEN
-					+ UIP_LLH_LEN + 1 + c] == TCP_OPT_MSS_LEN) {
-				/* An MSS option with the right option length. */
-				tmp16 = ((u16_t) uip_buf[UIP_TCPIP_HLEN + UIP_LLH_LEN + 2 + c]
-						<< 8) | (u16_t) uip_buf[UIP_IPTCPH_LEN + UIP_LLH_LEN
-						+ 3 + c];
-				uip_connr->initialmss = uip_connr->mss
-						= tmp16 > UIP_TCP_MSS ? UIP_TCP_MSS : tmp16;
-
-				/* And we are done processing options. */
-				break;
-			} else {
-				/* All other options have a length field, so that we easily
-				 can skip past them. */
-				if (uip_buf[UIP_TCPIP_HLEN + UIP_LLH_LEN + 1 + c] == 0) {
-					/* If the length field is zero, the options are malformed
-					 and we don't process them further. */
-					break;
-				}
-				c += uip_buf[UIP_TCPIP_HLEN + UIP_LLH_LEN + 1 + c];
-			}
-		}
-	}
+	/* Parse the TCP MSS option and the others we use, if present. */
+	uip_parse_synopts(uip_connr);
 
 	/* Our response will be a SYNACK. */
 #if UIP_ACTIVE_OPEN
@@ -1463,10 +2049,13 @@ void uip_process(u8_t flag) {
 	 SYNACK. */
 	BUF->optdata[0] = TCP_OPT_MSS;
 	BUF->optdata[1] = TCP_OPT_MSS_LEN;
-	BUF->optdata[2] = (UIP_TCP_MSS) / 256;
-	BUF->optdata[3] = (UIP_TCP_MSS) & 255;
+	BUF->optdata[2] = (UIP_RECEIVE_MSS) / 256;
+	BUF->optdata[3] = (UIP_RECEIVE_MSS) & 255;
 	uip_len = UIP_IPTCPH_LEN + TCP_OPT_MSS_LEN;
-	BUF->tcpoffset = ((UIP_TCPH_LEN + TCP_OPT_MSS_LEN) / 4) << 4;
+#if UIP_TCP_OOO || UIP_RCV_WSCALE
+	uip_len += uip_synopts(uip_connr);
+#endif
+	BUF->tcpoffset = ((uip_len - UIP_IPH_LEN) / 4) << 4;
 	goto tcp_send;
 
 	/* This label will be jumped to if we found an active connection. */
@@ -1478,6 +2067,12 @@ void uip_process(u8_t flag) {
 	 before we accept the reset. */
 	if (BUF->flags & TCP_RST) {
 		uip_connr->tcpstateflags = UIP_CLOSED;
+#if UIP_TCP_OOO
+		uip_ooo_flush(uip_connr);
+#endif
+#if UIP_DELAYED_ACK
+		uip_delack_clear(uip_connr);
+#endif
 		UIP_LOG("tcp: got reset, aborting connection.");
 		uip_flags = UIP_ABORT;
 		UIP_APPCALL();
@@ -1491,6 +2086,12 @@ void uip_process(u8_t flag) {
 	 c) and the length of the IP header (20 bytes). */
 	uip_len = uip_len - c - UIP_IPH_LEN;
 
+	/* Data after TCP options is moved to where the application expects
+	 it. The options of a SYN are still to be parsed. */
+	if (c > UIP_TCPH_LEN && uip_len > 0 && !(BUF->flags & TCP_SYN)) {
+		memmove(uip_appdata, (u8_t *) uip_appdata + c - UIP_TCPH_LEN, uip_len);
+	}
+
 	/* First, check if the sequence number of the incoming packet is
 	 what we're expecting next. If not, we send out an ACK with the
 	 correct numbers in. */
@@ -1498,6 +2099,9 @@ void uip_process(u8_t flag) {
 			&& ((BUF->flags & TCP_CTL) == (TCP_SYN | TCP_ACK)))) {
 		if ((uip_len > 0 || ((BUF->flags & (TCP_SYN | TCP_FIN)) != 0))
                     && (!xtcp_compare_words(BUF->seqno, uip_connr->rcv_nxt))) {
+#if UIP_TCP_OOO
+			uip_ooo_insert(uip_connr);
+#endif
 			goto tcp_send_ack;
 		}
 	}
@@ -1506,6 +2110,57 @@ void uip_process(u8_t flag) {
 	 data. If so, we update the sequence number, reset the length of
 	 the outstanding data, calculate RTT estimations, and reset the
 	 retransmission timer. */
+#if UIP_TCP_SEND_WINDOW
+	/* Cumulative ACK handling: anything up to snd_nxt + len may be
+	 acknowledged and the acknowledged bytes are released from the
+	 retransmit buffer. */
+	tmp16 = uip_peer_wnd(uip_connr);
+	if ((BUF->flags & TCP_ACK) && uip_outstanding(uip_connr)) {
+		int acked = xtcp_get_word(BUF->ackno) - xtcp_get_word(uip_connr->snd_nxt);
+
+		if (acked > 0 && acked <= uip_connr->len) {
+			xtcp_copy_word(uip_connr->snd_nxt, BUF->ackno);
+
+			/* Do RTT estimation, unless we have done retransmissions. */
+			if (uip_connr->nrtx == 0) {
+				int m;
+				m = uip_connr->rto - uip_connr->timer;
+				m = m - (uip_connr->sa >> 3);
+				uip_connr->sa += m;
+				if (m < 0) {
+					m = -m;
+				}
+				m = m - (uip_connr->sv >> 2);
+				uip_connr->sv += m;
+				uip_connr->rto = (uip_connr->sa >> 3) + uip_connr->sv;
+				if (uip_connr->rto < UIP_RTO_MIN) {
+					uip_connr->rto = UIP_RTO_MIN;
+				}
+			}
+
+			uip_flags = UIP_ACKDATA;
+			uip_connr->timer = uip_connr->rto;
+			uip_connr->len -= acked;
+			if (uip_connr->len == 0 && uip_connr->snd_unsent == 0) {
+				uip_connr->snd_head = 0;
+			} else {
+				uip_connr->snd_head += acked;
+				if (uip_connr->snd_head >= UIP_TCP_SEND_BUFFER_SIZE) {
+					uip_connr->snd_head -= UIP_TCP_SEND_BUFFER_SIZE;
+				}
+			}
+			uip_connr->dupacks = 0;
+		} else if (acked == 0 && uip_len == 0 &&
+				(BUF->flags & (TCP_SYN | TCP_FIN)) == 0 &&
+				tmp16 == uip_connr->snd_wnd &&
+				uip_connr->dupacks < 255) {
+			++(uip_connr->dupacks);
+		}
+	}
+	if (BUF->flags & TCP_ACK) {
+		uip_connr->snd_wnd = tmp16;
+	}
+#else
 	if ((BUF->flags & TCP_ACK) && uip_outstanding(uip_connr)) {
                uip_add32(uip_connr->snd_nxt, uip_connr->len);
 #if UIP_SLIDING_WINDOW
@@ -1526,7 +2181,7 @@ void uip_process(u8_t flag) {
 
 			/* Do RTT estimation, unless we have done retransmissions. */
 			if (uip_connr->nrtx == 0) {
-				signed char m;
+				int m;
 				m = uip_connr->rto - uip_connr->timer;
 				/* This is taken directly from VJs original code in his paper */
 				m = m - (uip_connr->sa >> 3);
@@ -1537,6 +2192,9 @@ void uip_process(u8_t flag) {
 				m = m - (uip_connr->sv >> 2);
 				uip_connr->sv += m;
 				uip_connr->rto = (uip_connr->sa >> 3) + uip_connr->sv;
+				if (uip_connr->rto < UIP_RTO_MIN) {
+					uip_connr->rto = UIP_RTO_MIN;
+				}
 
 			}
 
@@ -1560,6 +2218,7 @@ void uip_process(u8_t flag) {
                     }
 
 	}
+#endif /* UIP_TCP_SEND_WINDOW */
 
         if (BUF->flags & TCP_PSH) {
           uip_flags |= UIP_TCP_PUSH;
@@ -1598,38 +2257,8 @@ void uip_process(u8_t flag) {
 		if((uip_flags & UIP_ACKDATA) &&
 				(BUF->flags & TCP_CTL) == (TCP_SYN | TCP_ACK)) {
 
-			/* Parse the TCP MSS option, if present. */
-			if((BUF->tcpoffset & 0xf0) > 0x50) {
-				for(c = 0; c < ((BUF->tcpoffset >> 4) - 5) << 2;) {
-					opt = uip_buf[UIP_IPTCPH_LEN + UIP_LLH_LEN + c];
-					if(opt == TCP_OPT_END) {
-						/* End of options. */
-						break;
-					} else if(opt == TCP_OPT_NOOP) {
-						++c;
-						/* NOP option. */
-					} else if(opt == TCP_OPT_MSS &&
-							uip_buf[UIP_TCPIP_HLEN + UIP_LLH_LEN + 1 + c] == TCP_OPT_MSS_LEN) {
-						/* An MSS option with the right option length. */
-						tmp16 = (uip_buf[UIP_TCPIP_HLEN + UIP_LLH_LEN + 2 + c] << 8) |
-						uip_buf[UIP_TCPIP_HLEN + UIP_LLH_LEN + 3 + c];
-						uip_connr->initialmss =
-						uip_connr->mss = tmp16 > UIP_TCP_MSS? UIP_TCP_MSS: tmp16;
-
-						/* And we are done processing options. */
-						break;
-					} else {
-						/* All other options have a length field, so that we easily
-						 can skip past them. */
-						if(uip_buf[UIP_TCPIP_HLEN + UIP_LLH_LEN + 1 + c] == 0) {
-							/* If the length field is zero, the options are malformed
-							 and we don't process them further. */
-							break;
-						}
-						c += uip_buf[UIP_TCPIP_HLEN + UIP_LLH_LEN + 1 + c];
-					}
-				}
-			}
+			/* Parse the TCP MSS option and the others we use, if present. */
+			uip_parse_synopts(uip_connr);
 			uip_connr->tcpstateflags = UIP_ESTABLISHED;
 			xtcp_copy_word(uip_connr->rcv_nxt, BUF->seqno);
 			uip_add_rcv_nxt(1);
@@ -1645,6 +2274,9 @@ void uip_process(u8_t flag) {
 		UIP_APPCALL();
 		/* The connection is closed after we send the RST */
 		uip_conn->tcpstateflags = UIP_CLOSED;
+#if UIP_DELAYED_ACK
+		uip_delack_clear(uip_conn);
+#endif
 		goto reset;
 #endif /* UIP_ACTIVE_OPEN */
 
@@ -1665,6 +2297,9 @@ void uip_process(u8_t flag) {
 				goto drop;
 			}
 			uip_add_rcv_nxt(1 + uip_len);
+#if UIP_TCP_OOO
+			uip_ooo_flush(uip_connr);
+#endif
 			uip_flags |= UIP_CLOSE;
 			if (uip_len > 0) {
 				uip_flags |= UIP_NEWDATA;
@@ -1677,6 +2312,17 @@ void uip_process(u8_t flag) {
 			goto tcp_send_nodata;
 		}
 
+#if UIP_TCP_SEND_WINDOW
+		/* Fast retransmit: three duplicate ACKs mean the oldest segment
+		 has most likely been lost. */
+		if (uip_connr->dupacks == 3 && uip_outstanding(uip_connr)) {
+			++(uip_connr->dupacks);
+			uip_connr->timer = uip_connr->rto;
+			UIP_STAT(++uip_stat.tcp.rexmit);
+			goto tcp_rexmit_buffered;
+		}
+#endif
+
 		/* Check the URG flag. If this is set, the segment carries urgent
 		 data that we must pass to the application. */
 		if ((BUF->flags & TCP_URG) != 0) {
@@ -1711,6 +2357,9 @@ void uip_process(u8_t flag) {
                     ) {
 			uip_flags |= UIP_NEWDATA;
 			uip_add_rcv_nxt(uip_len);
+#if UIP_DELAYED_ACK
+			uip_delack_len = uip_len;
+#endif
 		}
 
 		/* Check if the available buffer space advertised by the other end
@@ -1725,7 +2374,7 @@ void uip_process(u8_t flag) {
 		 and the application will retransmit it. This is called the
 		 "persistent timer" and uses the retransmission mechanim.
 		 */
-		tmp16 = ((u16_t)BUF->wnd[0] << 8) + (u16_t)BUF->wnd[1];
+		tmp16 = uip_peer_wnd(uip_connr);
 		if (tmp16 > uip_connr->initialmss || tmp16 == 0) {
 			tmp16 = uip_connr->initialmss;
 		}
@@ -1753,17 +2402,52 @@ void uip_process(u8_t flag) {
 
 			appsend:
 
+#if UIP_TCP_OOO
+			if (uip_connr->ooo_head != 0 && !(uip_flags & (UIP_ABORT | UIP_CLOSE))) {
+				uip_ooo_deliver(uip_connr);
+#if UIP_DELAYED_ACK
+				/* Filling a hole, or leaving one, is acknowledged at once. */
+				uip_delack_len = 0;
+#endif
+			}
+#endif
+
 			if (uip_flags & UIP_ABORT) {
 				uip_slen = 0;
 				uip_connr->tcpstateflags = UIP_CLOSED;
+#if UIP_TCP_OOO
+				uip_ooo_flush(uip_connr);
+#endif
+#if UIP_DELAYED_ACK
+				uip_delack_clear(uip_connr);
+#endif
 				BUF->flags = TCP_RST | TCP_ACK;
 				goto tcp_send_nodata;
 			}
 
+#if UIP_TCP_SEND_WINDOW
+			if ((uip_flags & UIP_CLOSE) || uip_connr->fin_pending) {
+				/* The FIN can only be sent once all the buffered data
+				 has been acknowledged. */
+				if (uip_outstanding(uip_connr) || uip_connr->snd_unsent) {
+					uip_connr->fin_pending = 1;
+					uip_slen = 0;
+					if (uip_connr->snd_unsent != 0 &&
+							uip_tcp_window_space(uip_connr) != 0) {
+						goto tcp_send_unsent;
+					}
+					goto apprexmit;
+				}
+				uip_connr->fin_pending = 0;
+#else
 			if (uip_flags & UIP_CLOSE) {
+#endif
 				uip_slen = 0;
 				uip_connr->len = 1;
 				uip_connr->tcpstateflags = UIP_FIN_WAIT_1;
+#if UIP_TCP_OOO
+				uip_ooo_flush(uip_connr);
+#endif
 				uip_connr->nrtx = 0;
 				BUF->flags = TCP_FIN | TCP_ACK;
 				goto tcp_send_nodata;
@@ -1773,6 +2457,44 @@ void uip_process(u8_t flag) {
                         uip_connr->nrtx = 0;
 
 			/* If uip_slen > 0, the application has data to be sent. */
+#if UIP_TCP_SEND_WINDOW
+			if (uip_slen > 0) {
+				/* New data goes after whatever is already in flight. The
+				 application is only offered uip_tcp_send_space() bytes, so
+				 normally all of it can be sent now. Anything the window
+				 does not let out is kept as unsent data rather than
+				 dropped. */
+				tmp16 = UIP_TCP_SEND_BUFFER_SIZE - uip_connr->len -
+						uip_connr->snd_unsent;
+				if (uip_slen > tmp16) {
+					/* More than the retransmit buffer can hold is beyond
+					 what the application was offered */
+					uip_slen = tmp16;
+				}
+				if (uip_connr->snd_unsent == 0 &&
+						uip_slen <= uip_tcp_window_space(uip_connr)) {
+					uip_payload_sum = uip_sndbuf_copy(uip_connr, uip_connr->len,
+							uip_sappdata, uip_slen);
+					uip_payload_len = uip_slen;
+					uip_snd_offset = uip_connr->len;
+					uip_connr->len += uip_slen;
+					if (uip_tcp_send_space(uip_connr) > 0) {
+						/* Ask the application for the next segment */
+						xtcpd_send_credit_from_uip(uip_connr);
+					}
+				} else {
+					uip_sndbuf_copy(uip_connr,
+							uip_connr->len + uip_connr->snd_unsent,
+							uip_sappdata, uip_slen);
+					uip_connr->snd_unsent += uip_slen;
+					uip_slen = 0;
+				}
+			}
+			if (uip_slen == 0 && uip_connr->snd_unsent != 0 &&
+					uip_tcp_window_space(uip_connr) != 0) {
+				goto tcp_send_unsent;
+			}
+#else
 			if (uip_slen > 0) {
 
 #if UIP_SLIDING_WINDOW
@@ -1823,6 +2545,7 @@ void uip_process(u8_t flag) {
 				}
 
 			}
+#endif /* UIP_TCP_SEND_WINDOW */
 
 
 
@@ -1832,7 +2555,11 @@ void uip_process(u8_t flag) {
 			 packet had new data in it, we must send out a packet. */
 			if (uip_slen > 0 && uip_connr->len > 0) {
 				/* Add the length of the IP and TCP headers. */
+#if UIP_TCP_SEND_WINDOW
+				uip_len = uip_slen + UIP_TCPIP_HLEN;
+#else
 				uip_len = uip_connr->len + UIP_TCPIP_HLEN;
+#endif
 				/* We always set the ACK flag in response packets. */
 				BUF->flags = TCP_ACK | TCP_PSH;
 				/* Send the packet. */
@@ -1841,17 +2568,39 @@ void uip_process(u8_t flag) {
 			/* If there is no data to send, just send out a pure ACK if
 			 there is newdata. */
 			if (uip_flags & UIP_NEWDATA) {
-				uip_len = UIP_TCPIP_HLEN;
-				BUF->flags = TCP_ACK;
-				goto tcp_send_noopts;
+#if UIP_DELAYED_ACK
+				/* In-order data may wait for a second segment, a reply from
+				 the application or the timer, unless the peer would be left
+				 with no window to send into. */
+				if (uip_delack_len != 0 &&
+						!(uip_connr->tcpstateflags & UIP_STOPPED) &&
+						uip_connr->delack_bytes + uip_delack_len < UIP_DELACK_BYTES) {
+					if (uip_connr->delack_bytes == 0) {
+						uip_twheel_arm(&uip_connr->delack_tmr, UIP_DELACK_MS);
+					}
+					uip_connr->delack_bytes += uip_delack_len;
+					UIP_STAT(++uip_stat.tcp.ackdelayed);
+					goto drop;
+				}
+#endif
+				goto tcp_send_ack;
 			}
 		}
+#if UIP_TCP_SEND_WINDOW
+		/* A window update lets out data that was waiting for it. */
+		if (uip_connr->snd_unsent != 0 && uip_tcp_window_space(uip_connr) != 0) {
+			goto tcp_send_unsent;
+		}
+#endif
 		goto drop;
 	case UIP_LAST_ACK:
 		/* We can close this connection if the peer has acknowledged our
 		 FIN. This is indicated by the UIP_ACKDATA flag. */
 		if (uip_flags & UIP_ACKDATA) {
 			uip_connr->tcpstateflags = UIP_CLOSED;
+#if UIP_DELAYED_ACK
+			uip_delack_clear(uip_connr);
+#endif
 			uip_flags = UIP_CLOSE;
 			UIP_APPCALL();
 		}
@@ -1914,9 +2663,50 @@ void uip_process(u8_t flag) {
 	}
 	goto drop;
 
+#if UIP_TCP_SEND_WINDOW
+	/* Retransmit the oldest unacknowledged segment from the connection's
+	 retransmit buffer. */
+	tcp_rexmit_buffered:
+	uip_slen = uip_connr->len;
+	if (uip_slen > uip_connr->initialmss) {
+		uip_slen = uip_connr->initialmss;
+	}
+	uip_sndbuf_frags(uip_connr, 0, uip_slen);
+	uip_snd_offset = 0;
+	uip_len = uip_slen + UIP_TCPIP_HLEN;
+	BUF->flags = TCP_ACK | TCP_PSH;
+	goto tcp_send_noopts;
+
+	/* Send as much of the unsent data as the remote host's window lets
+	 out, straight from the retransmit buffer. */
+	tcp_send_unsent:
+	uip_slen = uip_tcp_window_space(uip_connr);
+	if (uip_slen > uip_connr->snd_unsent) {
+		uip_slen = uip_connr->snd_unsent;
+	}
+	uip_sndbuf_frags(uip_connr, uip_connr->len, uip_slen);
+	uip_snd_offset = uip_connr->len;
+	uip_connr->len += uip_slen;
+	uip_connr->snd_unsent -= uip_slen;
+	if (uip_tcp_send_space(uip_connr) > 0) {
+		/* Ask the application for the next segment */
+		xtcpd_send_credit_from_uip(uip_connr);
+	}
+	uip_len = uip_slen + UIP_TCPIP_HLEN;
+	BUF->flags = TCP_ACK | TCP_PSH;
+	goto tcp_send_noopts;
+#endif
+
 	/* We jump here when we are ready to send the packet, and just want
 	 to set the appropriate TCP sequence numbers in the TCP header. */
 	tcp_send_ack: BUF->flags = TCP_ACK;
+#if UIP_TCP_OOO
+	if (uip_connr->ooo_head != 0 && uip_connr->sack_ok) {
+		uip_len = UIP_IPTCPH_LEN + uip_sack_option(uip_connr);
+		BUF->tcpoffset = ((uip_len - UIP_IPH_LEN) / 4) << 4;
+		goto tcp_send;
+	}
+#endif
 	tcp_send_nodata: uip_len = UIP_IPTCPH_LEN;
 	tcp_send_noopts: BUF->tcpoffset = (UIP_TCPH_LEN / 4) << 4;
 	tcp_send:
@@ -1925,8 +2715,34 @@ void uip_process(u8_t flag) {
 	 headers before calculating the checksum and finally send the
 	 packet. */
 	xtcp_copy_word(BUF->ackno, uip_connr->rcv_nxt);
+#if UIP_DELAYED_ACK
+	/* Every segment acknowledges everything received so far. */
+	if (uip_connr->delack_bytes != 0) {
+		if (flag != UIP_DELACK_TIMER) {
+			UIP_STAT(++uip_stat.tcp.ackcoalesced);
+		}
+		uip_connr->delack_bytes = 0;
+		uip_twheel_cancel(&uip_connr->delack_tmr);
+	}
+#endif
+#if UIP_STATISTICS == 1
+	if (uip_len == UIP_TCPIP_HLEN && BUF->flags == TCP_ACK) {
+		UIP_STAT(++uip_stat.tcp.pureack);
+	}
+#endif
 
 	xtcp_copy_word(BUF->seqno, uip_connr->snd_nxt);
+#if UIP_TCP_SEND_WINDOW
+	/* snd_nxt is the oldest unacknowledged byte; new data and pure ACKs
+	 carry the sequence number after everything in flight. */
+	if ((uip_connr->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED) {
+		u16_t offset = uip_snd_offset >= 0 ? uip_snd_offset : uip_connr->len;
+		if (offset) {
+			uip_add32(BUF->seqno, offset);
+			xtcp_copy_word(BUF->seqno, uip_acc32);
+		}
+	}
+#endif
 #if UIP_SLIDING_WINDOW
         if (uip_connr->midpoint && uip_slen) {
           uip_add32(BUF->seqno, uip_connr->midpoint);
@@ -1954,8 +2770,21 @@ void uip_process(u8_t flag) {
 		 window so that the remote host will stop sending data. */
 		BUF->wnd[0] = BUF->wnd[1] = 0;
 	} else {
+#if UIP_RCV_WSCALE
+		/* The window in a SYN is never scaled. */
+		u32_t wnd = UIP_RECEIVE_WINDOW;
+		if (!(BUF->flags & TCP_SYN)) {
+			wnd >>= uip_connr->rcv_wscale;
+		}
+		if (wnd > 0xffff) {
+			wnd = 0xffff;
+		}
+		BUF->wnd[0] = wnd >> 8;
+		BUF->wnd[1] = wnd & 0xff;
+#else
 		BUF->wnd[0] = ((UIP_RECEIVE_WINDOW) >> 8);
 		BUF->wnd[1] = ((UIP_RECEIVE_WINDOW) & 0xff);
+#endif
 	}
 
 	tcp_send_noconn: BUF->ttl = UIP_TTL;
@@ -1987,9 +2816,11 @@ void uip_process(u8_t flag) {
 	BUF->ipid[0] = ipid >> 8;
 	BUF->ipid[1] = ipid & 0xff;
 	/* Calculate IP checksum. */
-	BUF->ipchksum = 0;
-	BUF->ipchksum = ~(uip_ipchksum());
-	DEBUG_PRINTF("uip ip_send_nolen: chkecum 0x%04x\n", uip_ipchksum());
+	if (!uip_tx_chksum_offloaded()) {
+		BUF->ipchksum = 0;
+		BUF->ipchksum = ~(uip_ipchksum());
+		DEBUG_PRINTF("uip ip_send_nolen: chkecum 0x%04x\n", uip_ipchksum());
+	}
 #endif /* UIP_CONF_IPV6 */
 
 	UIP_STAT(++uip_stat.tcp.sent);
@@ -56,6 +56,7 @@
 #define __UIP_H__
 
 #include "uipopt.h"
+#include "uip_twheel.h"
 
 /**
  * Repressentation of an IP address.
@@ -339,6 +340,21 @@ void uip_setipid(u16_t id);
 #define uip_poll_conn(conn) do { uip_conn = conn; \
                                  uip_process(UIP_POLL_REQUEST); } while (0)
 
+#if UIP_DELAYED_ACK
+/**
+ * Send the ACK a connection has been holding back, if it still has one.
+ *
+ * Called when the connection's delayed ACK timer fires.
+ *
+ * \param conn A pointer to the uip_conn struct for the connection to
+ * be processed.
+ *
+ * \hideinitializer
+ */
+#define uip_delack_conn(conn) do { uip_conn = conn; \
+                                   uip_process(UIP_DELACK_TIMER); } while (0)
+#endif
+
 
 #if UIP_UDP
 /**
@@ -459,6 +475,78 @@ void uip_setipid(u16_t id);
 //extern u8_t uip_buf[UIP_BUFSIZE+2];
 extern u8_t *uip_buf;
 
+/**
+ * Make sure uip_buf is the stack's own packet buffer.
+ *
+ * A received frame may be processed in place in the buffer it was
+ * received into, which only has room for the frame itself. This copies
+ * it into the full size buffer, and moves uip_appdata with it, before
+ * anything longer than the received frame is written.
+ */
+void uip_buf_own(void);
+
+/**
+ * Payload that is sent after the headers in uip_buf.
+ *
+ * An outgoing packet can reference its payload where it already lives,
+ * e.g. a TCP connection's retransmit buffer, rather than having it copied
+ * in after the headers. uip_len still counts the whole packet: the first
+ * uip_len - uip_txfrag_len bytes come from uip_buf and the rest from
+ * uip_txfrags[0..uip_txfrag_count-1] in order. The checksums cover the
+ * fragments and the device driver gathers them when it queues the frame.
+ *
+ * Only TCP data sent from the retransmit buffer uses fragments:
+ * retransmissions, and data queued until the remote host's window opens.
+ * Data the application has just written is already in uip_buf, where the
+ * copy into the retransmit buffer is fused with its checksum, so a first
+ * send is built contiguously.
+ */
+struct uip_txfrag {
+  const u8_t *data;
+  u16_t len;
+};
+
+#define UIP_TX_MAX_FRAGS 2
+
+extern struct uip_txfrag uip_txfrags[UIP_TX_MAX_FRAGS];
+extern u8_t uip_txfrag_count;
+extern u16_t uip_txfrag_len;
+
+#define uip_txfrag_clear() do { uip_txfrag_count = 0; \
+                                uip_txfrag_len = 0; } while (0)
+
+#if UIP_TCP_SEND_WINDOW
+/**
+ * Forget the payload sum that uip_process() kept for the TCP checksum of
+ * the packet it built. Call this before putting any other frame in
+ * uip_buf to be sent.
+ */
+void uip_payload_sum_clear(void);
+#else
+#define uip_payload_sum_clear()
+#endif
+
+/**
+ * Checksums handled by the network device.
+ *
+ * The device driver sets uip_rx_chksum_ok to the checksums of the packet
+ * in uip_buf that the device has already verified, and sets
+ * uip_tx_chksum_offload if the device fills in the checksums of the
+ * packets it sends.
+ */
+#define UIP_RX_IPCHKSUM_OK 1
+#define UIP_RX_L4CHKSUM_OK 2
+
+#if UIP_CHECKSUM_OFFLOAD
+extern u8_t uip_rx_chksum_ok;
+extern u8_t uip_tx_chksum_offload;
+#define uip_rx_chksum_verified(flag) (uip_rx_chksum_ok & (flag))
+#define uip_tx_chksum_offloaded() uip_tx_chksum_offload
+#else
+#define uip_rx_chksum_verified(flag) 0
+#define uip_tx_chksum_offloaded() 0
+#endif
+
 /** @} */
 
 /*---------------------------------------------------------------------------*/
@@ -782,7 +870,11 @@ void uip_send(const void *data, int len);
  *
  * \hideinitializer
  */
+#if UIP_TCP_SEND_WINDOW
+#define uip_mss()             uip_tcp_send_space(uip_conn)
+#else
 #define uip_mss()             (uip_conn->mss)
+#endif
 
 /**
  * Set up a new UDP connection.
@@ -1215,18 +1307,47 @@ struct uip_conn {
 			 connection. */
   u16_t initialmss;   /**< Initial maximum segment size for the
 			 connection. */
-  u8_t sa;            /**< Retransmission time-out calculation state
+  u16_t sa;           /**< Retransmission time-out calculation state
 			 variable. */
-  u8_t sv;            /**< Retransmission time-out calculation state
+  u16_t sv;           /**< Retransmission time-out calculation state
 			 variable. */
-  u8_t rto;           /**< Retransmission time-out. */
+  u16_t rto;          /**< Retransmission time-out. */
+  u16_t timer;        /**< The retransmission timer. */
   u8_t tcpstateflags; /**< TCP state and flags. */
-  u8_t timer;         /**< The retransmission timer. */
   u8_t nrtx;          /**< The number of retransmissions for the last
 			 segment sent. */
+  struct uip_twheel_timer tick; /**< Runs the TCP timer every
+				   UIP_TCP_TICK_MS while it is needed. */
+#if UIP_TCP_OOO
+  u8_t ooo_head;      /**< Index + 1 of the first segment held out of
+			 order, 0 if there are none. */
+  u8_t sack_ok;       /**< The remote host accepts SACK options. */
+#endif
+#if UIP_RCV_WSCALE
+  u8_t snd_wscale;    /**< Shift for the window the remote host
+			 advertises. */
+  u8_t rcv_wscale;    /**< Shift for the window we advertise, 0 if the
+			 remote host does not do window scaling. */
+#endif
+#if UIP_DELAYED_ACK
+  u16_t delack_bytes; /**< Bytes received but not yet acknowledged. */
+  struct uip_twheel_timer delack_tmr; /**< Sends the delayed ACK. */
+#endif
 
 #if UIP_SLIDING_WINDOW
   u8_t midpoint;
+#endif
+#if UIP_TCP_SEND_WINDOW
+  u16_t snd_wnd;      /**< The window last advertised by the remote
+			 host. */
+  u16_t snd_head;     /**< Offset of the oldest unacknowledged byte in
+			 the connection's retransmit buffer. */
+  u16_t snd_unsent;   /**< Bytes after the unacknowledged data in the
+			 retransmit buffer that the remote host's window
+			 has not let out yet. */
+  u8_t dupacks;       /**< The number of duplicate ACKs received. */
+  u8_t fin_pending;   /**< The application has closed the connection
+			 while data is unacknowledged. */
 #endif
   /** The application state. */
   uip_tcp_appstate_t appstate;
@@ -1241,6 +1362,27 @@ struct uip_conn {
 extern struct uip_conn *uip_conn;
 /* The array containing all uIP connections. */
 extern struct uip_conn uip_conns[UIP_CONNS];
+
+/**
+ * (Re)insert a connection into the hash used to demultiplex incoming
+ * segments. This must be called whenever the local port, remote port
+ * or remote IP address of a connection changes.
+ */
+void uip_conn_hash_insert(struct uip_conn *conn);
+
+/**
+ * Remove a connection from the demultiplexing hash.
+ */
+void uip_conn_hash_remove(struct uip_conn *conn);
+
+#if UIP_TCP_SEND_WINDOW
+/**
+ * The amount of new data that can be sent on a connection right now,
+ * limited by the remote host's window, the space left in the
+ * connection's retransmit buffer and the MSS.
+ */
+u16_t uip_tcp_send_space(struct uip_conn *conn);
+#endif
 /**
  * \addtogroup uiparch
  * @{
@@ -1264,6 +1406,8 @@ struct uip_udp_conn {
   u16_t rport;        /**< The remote port number in network byte order. */
   u8_t  ttl;          /**< Default time-to-live. */
   u8_t  udpflags;     /**< UDP state flags */
+  struct uip_twheel_timer tick; /**< Polls the connection when its
+				   application has something to time. */
 
   /** The application state. */
   uip_udp_appstate_t appstate;
@@ -1336,6 +1480,12 @@ struct uip_stats {
 			     connections was avaliable. */
     uip_stats_t synrst;   /**< Number of SYNs for closed ports,
 			     triggering a RST. */
+    uip_stats_t pureack;  /**< Number of TCP segments sent carrying only
+			     an ACK. */
+    uip_stats_t ackdelayed; /**< Number of ACKs held back by the delayed
+			       ACK timer. */
+    uip_stats_t ackcoalesced; /**< Number of held back ACKs that went out
+				 on another segment instead of their own. */
   } tcp;                  /**< TCP statistics. */
 #if UIP_UDP
   struct {
@@ -1437,6 +1587,8 @@ void uip_process(u8_t flag);
 #define UIP_UDP_ARP_EVENT     6
 #define UIP_UDP_ACKDATA       7
 #endif /* UIP_UDP */
+#define UIP_DELACK_TIMER  8     /* Tells uIP that a connection's
+				   delayed ACK timer has fired. */
 
 /* The TCP states used in the uip_conn->tcpstateflags. */
 #define UIP_CLOSED      0
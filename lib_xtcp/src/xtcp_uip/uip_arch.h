@@ -113,6 +113,20 @@ void uip_add32(u8_t *op32, u16_t op16);
  */
 u16_t uip_chksum(u16_t *buf, u16_t len);
 
+/**
+ * Update an Internet checksum for a 16-bit word of the data it covers
+ * being rewritten, without summing the data again.
+ *
+ * See RFC1624.
+ *
+ * \param chksum A pointer to the checksum field, in network byte order.
+ *
+ * \param old The old value of the word, in network byte order.
+ *
+ * \param new The new value of the word, in network byte order.
+ */
+void uip_chksum_update(u16_t *chksum, u16_t old, u16_t new);
+
 /**
  * Calculate the IP header checksum of the packet header in uip_buf.
  *
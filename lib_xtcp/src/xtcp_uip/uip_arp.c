@@ -115,7 +115,37 @@ static struct arp_entry arp_table[UIP_ARPTAB_SIZE];
 static u16_t ipaddr[2];
 static u8_t i, c;
 
+#if UIP_ARPTAB_SIZE > 254
+#error "UIP_ARPTAB_SIZE must be less than 255"
+#endif
+
+/* Hash chains over the IP address of the ARP table entries in use.
+   Entries are arp_table index + 1 with 0 ending a chain. */
+static u8_t arp_hash[UIP_ARP_HASH_SIZE];
+static u8_t arp_hnext[UIP_ARPTAB_SIZE];
+
+#if UIP_ARP_QUEUE_LEN
+/* Packets waiting for the MAC address of their next hop. The frame is
+   complete apart from its destination address. A slot with len 0 is
+   free. */
+struct arp_queue_entry {
+  u16_t ipaddr[2];
+  u16_t len;
+  u8_t time;
+  u8_t seq;
+  u32_t frame[(UIP_BUFSIZE + 3) >> 2];
+};
+
+static struct arp_queue_entry arp_queue[UIP_ARP_QUEUE_LEN];
+static u8_t arp_queued;
+static u8_t arp_queue_seq;
+#endif
+
 static u8_t arptime;
+
+/* Set whenever a UDP connection has been marked UDP_SENT so that the
+   server only scans for UDP acks when there are some. */
+int uip_udp_acks_pending = 0;
 static u8_t tmpage;
 
 #define BUF   ((struct arp_hdr *)&uip_buf[0])
@@ -132,6 +162,49 @@ uip_arp_init(void)
   for(i = 0; i < UIP_ARPTAB_SIZE; ++i) {
     memset(arp_table[i].ipaddr, 0, 4);
   }
+  memset(arp_hash, 0, sizeof(arp_hash));
+#if UIP_ARP_QUEUE_LEN
+  for(i = 0; i < UIP_ARP_QUEUE_LEN; ++i) {
+    arp_queue[i].len = 0;
+  }
+  arp_queued = 0;
+#endif
+}
+/*-----------------------------------------------------------------------------------*/
+static u8_t
+arp_hashfn(const u16_t *ipaddr)
+{
+  u16_t h = ipaddr[0] ^ ipaddr[1];
+  return (h ^ (h >> 8)) & (UIP_ARP_HASH_SIZE - 1);
+}
+/*-----------------------------------------------------------------------------------*/
+static struct arp_entry *
+arp_lookup(const u16_t *ipaddr)
+{
+  u8_t e;
+
+  for(e = arp_hash[arp_hashfn(ipaddr)]; e != 0; e = arp_hnext[e - 1]) {
+    if(uip_ipaddr_cmp(ipaddr, arp_table[e - 1].ipaddr)) {
+      return &arp_table[e - 1];
+    }
+  }
+  return NULL;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+arp_unlink(struct arp_entry *tabptr)
+{
+  u8_t *link = &arp_hash[arp_hashfn(tabptr->ipaddr)];
+  u8_t e = tabptr - arp_table + 1;
+
+  while(*link != 0) {
+    if(*link == e) {
+      *link = arp_hnext[e - 1];
+      break;
+    }
+    link = &arp_hnext[*link - 1];
+  }
+  memset(tabptr->ipaddr, 0, 4);
 }
 /*-----------------------------------------------------------------------------------*/
 /**
@@ -153,38 +226,33 @@ uip_arp_timer(void)
     tabptr = &arp_table[i];
     if((tabptr->ipaddr[0] | tabptr->ipaddr[1]) != 0 &&
        arptime - tabptr->time >= UIP_ARP_MAXAGE) {
-      memset(tabptr->ipaddr, 0, 4);
+      arp_unlink(tabptr);
     }
   }
 
+#if UIP_ARP_QUEUE_LEN
+  /* Give up on packets whose next hop has not answered for a while. */
+  for(i = 0; i < UIP_ARP_QUEUE_LEN; ++i) {
+    if(arp_queue[i].len != 0 && (u8_t)(arptime - arp_queue[i].time) >= 2) {
+      arp_queue[i].len = 0;
+      --arp_queued;
+    }
+  }
+#endif
+
 }
 /*-----------------------------------------------------------------------------------*/
 static void
 uip_arp_update(u16_t *ipaddr, struct uip_eth_addr *ethaddr)
 {
   register struct arp_entry *tabptr;
-  /* Walk through the ARP mapping table and try to find an entry to
-     update. If none is found, the IP -> MAC address mapping is
-     inserted in the ARP table. */
-  for(i = 0; i < UIP_ARPTAB_SIZE; ++i) {
-
-    tabptr = &arp_table[i];
-    /* Only check those entries that are actually in use. */
-    if(tabptr->ipaddr[0] != 0 &&
-       tabptr->ipaddr[1] != 0) {
-
-      /* Check if the source IP address of the incoming packet matches
-         the IP address in this ARP table entry. */
-      if(ipaddr[0] == tabptr->ipaddr[0] &&
-	 ipaddr[1] == tabptr->ipaddr[1]) {
-
-	/* An old entry found, update this and return. */
-	memcpy(tabptr->ethaddr.addr, ethaddr->addr, 6);
-	tabptr->time = arptime;
 
-	return;
-      }
-    }
+  /* If the address already has an entry, just update it. */
+  tabptr = arp_lookup(ipaddr);
+  if(tabptr != NULL) {
+    memcpy(tabptr->ethaddr.addr, ethaddr->addr, 6);
+    tabptr->time = arptime;
+    return;
   }
 
   /* If we get here, no existing ARP table entry was found, so we
@@ -213,6 +281,7 @@ uip_arp_update(u16_t *ipaddr, struct uip_eth_addr *ethaddr)
     }
     i = c;
     tabptr = &arp_table[i];
+    arp_unlink(tabptr);
   }
 
   /* Now, i is the ARP table entry which we will fill with the new
@@ -220,7 +289,116 @@ uip_arp_update(u16_t *ipaddr, struct uip_eth_addr *ethaddr)
   memcpy(tabptr->ipaddr, ipaddr, 4);
   memcpy(tabptr->ethaddr.addr, ethaddr->addr, 6);
   tabptr->time = arptime;
+  c = arp_hashfn(ipaddr);
+  arp_hnext[i] = arp_hash[c];
+  arp_hash[c] = i + 1;
+}
+/*-----------------------------------------------------------------------------------*/
+#if UIP_ARP_QUEUE_LEN
+/* Keep a copy of the frame in uip_buf, which is complete apart from its
+   destination address, until the MAC address of ipaddr is known. Each
+   destination may have UIP_ARP_QUEUE_PER_DEST frames waiting, after
+   which its oldest one makes way. */
+static int
+arp_enqueue(void)
+{
+  struct arp_queue_entry *q, *slot = NULL, *oldest = NULL;
+  u16_t hdr_len = uip_len - uip_txfrag_len;
+  u8_t *dst;
+  int queued = 0;
+  int k;
+
+  if(uip_len > UIP_BUFSIZE) {
+    return 0;
+  }
+
+  for(k = 0; k < UIP_ARP_QUEUE_LEN; ++k) {
+    q = &arp_queue[k];
+    if(q->len == 0) {
+      if(slot == NULL) {
+        slot = q;
+      }
+    } else if(uip_ipaddr_cmp(q->ipaddr, ipaddr)) {
+      ++queued;
+      if(oldest == NULL ||
+         (u8_t)(arp_queue_seq - q->seq) > (u8_t)(arp_queue_seq - oldest->seq)) {
+        oldest = q;
+      }
+    }
+  }
+  if(queued >= UIP_ARP_QUEUE_PER_DEST) {
+    slot = oldest;
+    --arp_queued;
+  } else if(slot == NULL) {
+    return 0;
+  }
+
+  dst = (u8_t *) slot->frame;
+  memcpy(dst, uip_buf, hdr_len);
+  dst += hdr_len;
+  for(k = 0; k < uip_txfrag_count; ++k) {
+    memcpy(dst, uip_txfrags[k].data, uip_txfrags[k].len);
+    dst += uip_txfrags[k].len;
+  }
+  uip_ipaddr_copy(slot->ipaddr, ipaddr);
+  slot->len = uip_len;
+  slot->time = arptime;
+  slot->seq = arp_queue_seq++;
+  ++arp_queued;
+  return 1;
+}
+/*-----------------------------------------------------------------------------------*/
+/**
+ * Take a queued packet whose next hop has been resolved.
+ *
+ * This function should be called after an incoming ARP packet has been
+ * processed, and again for as long as it returns non-zero. Each time
+ * it does, uip_buf holds an Ethernet frame of uip_len bytes that
+ * should be sent out.
+ */
+/*-----------------------------------------------------------------------------------*/
+int
+uip_arp_queue_out(void)
+{
+  struct arp_entry *tabptr, *oldest_tabptr = NULL;
+  struct arp_queue_entry *oldest = NULL;
+  int k;
+
+  if(arp_queued == 0) {
+    return 0;
+  }
+  /* Frames are sent in the order they were queued, so that those to
+     one destination are not reordered. */
+  for(k = 0; k < UIP_ARP_QUEUE_LEN; ++k) {
+    struct arp_queue_entry *q = &arp_queue[k];
+    if(q->len == 0) {
+      continue;
+    }
+    if(oldest != NULL &&
+       (u8_t)(arp_queue_seq - q->seq) <= (u8_t)(arp_queue_seq - oldest->seq)) {
+      continue;
+    }
+    tabptr = arp_lookup(q->ipaddr);
+    if(tabptr != NULL) {
+      oldest = q;
+      oldest_tabptr = tabptr;
+    }
+  }
+  if(oldest == NULL) {
+    return 0;
+  }
+  uip_buf_own();
+  memcpy(uip_buf, oldest->frame, oldest->len);
+  memcpy(IPBUF->ethhdr.dest.addr, oldest_tabptr->ethaddr.addr, 6);
+  uip_len = oldest->len;
+  uip_txfrag_clear();
+  /* The frame is whole, so no sum left from uip_process() applies to it */
+  uip_payload_sum_clear();
+  oldest->len = 0;
+  --arp_queued;
+  return 1;
 }
+#endif
 /*-----------------------------------------------------------------------------------*/
 /**
  * ARP processing for incoming IP packets
@@ -347,9 +525,10 @@ uip_arp_arpin(void)
  * address is found. If so, an Ethernet header is prepended and the
  * function returns. If no ARP cache entry is found for the
  * destination IP address, the packet in the uip_buf[] is replaced by
- * an ARP request packet for the IP address. The IP packet is dropped
- * and it is assumed that they higher level protocols (e.g., TCP)
- * eventually will retransmit the dropped packet.
+ * an ARP request packet for the IP address. The IP packet is queued
+ * until the reply comes in, see uip_arp_queue_out(). If the queue has
+ * no room it is dropped and it is assumed that they higher level
+ * protocols (e.g., TCP) eventually will retransmit the dropped packet.
  *
  * If the destination IP address is not on the local network, the IP
  * address of the default router is used instead.
@@ -394,16 +573,20 @@ uip_arp_out(struct uip_udp_conn *conn)
       uip_ipaddr_copy(ipaddr, IPBUF->destipaddr);
     }
 
-    for(i = 0; i < UIP_ARPTAB_SIZE; ++i) {
-      tabptr = &arp_table[i];
-      if(uip_ipaddr_cmp(ipaddr, tabptr->ipaddr)) {
-	break;
-      }
-    }
+    tabptr = arp_lookup(ipaddr);
 
-    if(i == UIP_ARPTAB_SIZE) {
+    if(tabptr == NULL) {
       /* The destination address was not in our ARP table, so we
-	 overwrite the IP packet with an ARP request. */
+	 overwrite the IP packet with an ARP request. The packet is
+	 kept to be sent once the reply is in, if there is room. */
+#if UIP_ARP_QUEUE_LEN
+      int queued;
+
+      memcpy(IPBUF->ethhdr.src.addr, uip_ethaddr.addr, 6);
+      IPBUF->ethhdr.type = HTONS(UIP_ETHTYPE_IP);
+      uip_len += sizeof(struct uip_eth_hdr);
+      queued = arp_enqueue();
+#endif
 
       memset(BUF->ethhdr.dest.addr, 0xff, 6);
       memset(BUF->dhwaddr.addr, 0x00, 6);
@@ -422,10 +605,18 @@ uip_arp_out(struct uip_udp_conn *conn)
       uip_appdata = &uip_buf[UIP_TCPIP_HLEN + UIP_LLH_LEN];
 
       uip_len = sizeof(struct arp_hdr);
+      uip_txfrag_clear();
 
       /* If we have a dependent udp connection mark it as pending an arp reply
        */
 
+#if UIP_ARP_QUEUE_LEN
+      if (conn != NULL && queued) {
+        conn->udpflags |= UDP_SENT;
+        uip_udp_acks_pending = 1;
+      }
+      else
+#endif
       if (conn != NULL)
         conn->udpflags |= UDP_PENDING_ARP;
 
@@ -439,8 +630,10 @@ uip_arp_out(struct uip_udp_conn *conn)
 
   IPBUF->ethhdr.type = HTONS(UIP_ETHTYPE_IP);
 
-  if (conn != NULL)
+  if (conn != NULL) {
     conn->udpflags |= UDP_SENT;
+    uip_udp_acks_pending = 1;
+  }
 
   uip_len += sizeof(struct uip_eth_hdr);
 }
@@ -100,18 +100,30 @@ void uip_arp_arpin(void);
    address filled in if an ARP table entry for the destination IP
    address (or the IP address of the default router) is present. If no
    such table entry is found, the IP packet is overwritten with an ARP
-   request and we rely on TCP to retransmit the packet that was
-   overwritten. In any case, the uip_len variable holds the length of
-   the Ethernet frame that should be transmitted.
+   request. A copy of the packet is queued to be sent when the reply
+   comes in; if the queue is full we rely on TCP to retransmit the
+   packet that was overwritten. In any case, the uip_len variable holds
+   the length of the Ethernet frame that should be transmitted.
 
    The function takes one argument which is an optional pointer to a
    udp connection. If supplied, and the arp packet overwrites the
    existing packet then the PENDING_ARP flag is set in that udp
    connection so that when an arp reply comes back the application layer
-   is asked to retransmit the udp packet.
+   is asked to retransmit the udp packet. A queued udp packet counts as
+   sent.
 */
 void uip_arp_out(struct uip_udp_conn* conn);
 
+#if UIP_ARP_QUEUE_LEN
+/* The uip_arp_queue_out() function should be called after
+   uip_arp_arpin(), and for as long as it returns non-zero. Each time
+   it does, a queued packet whose destination has now been resolved is
+   in the uip_buf buffer and uip_len holds its length. */
+int uip_arp_queue_out(void);
+#endif
+
+extern int uip_udp_acks_pending;
+
 /* The uip_arp_timer() function should be called every ten seconds. It
    is responsible for flushing old entries in the ARP table. */
 void uip_arp_timer(void);
@@ -3,17 +3,28 @@
 #include <print.h>
 #include <xccompat.h>
 #include <string.h>
+#include <stddef.h>
 
 #include "uip.h"
 #include "uip_arp.h"
 #include "uip-split.h"
 #include "uip_xtcp.h"
 #include "autoip.h"
+#include "xcoredev.h"
 
 // This is the buffer where TCP constructs its packets
 unsigned int uip_buf32[(UIP_BUFSIZE + 5) >> 2];
 u8_t *uip_buf = (u8_t *) &uip_buf32[0];
 
+/* While a received frame is processed in place, uip_buf points into the
+   MAC's buffer and this is the number of bytes that may be written there.
+   It is zero when uip_buf is uip_buf32. */
+static u16_t uip_buf_frame_size;
+
+/* The MAC buffer for a frame of the minimum size also holds its CRC, so
+   replies up to this size can be built in place. */
+#define UIP_FRAME_MIN_SIZE 64
+
 #define BUF ((struct uip_eth_hdr *)&uip_buf[0])
 #define TCPBUF ((struct uip_tcpip_hdr *)&uip_buf[UIP_LLH_LEN])
 
@@ -42,9 +53,24 @@ xtcp_ipconfig_t uip_static_ipconfig;
 
 static int dhcp_done = 0;
 
+static void xtcp_timers_init(void);
+
 void xtcp_tx_buffer(void) {
   uip_split_output();
   uip_len = 0;
+  uip_txfrag_clear();
+}
+
+void uip_tx_gather(unsigned char dst[])
+{
+	u16_t hdr_len = uip_len - uip_txfrag_len;
+
+	memcpy(dst, uip_buf, hdr_len);
+	dst += hdr_len;
+	for (int i = 0; i < uip_txfrag_count; i++) {
+		memcpy(dst, uip_txfrags[i].data, uip_txfrags[i].len);
+		dst += uip_txfrags[i].len;
+	}
 }
 
 void uip_server_init(chanend xtcp[], int num_xtcp, xtcp_ipconfig_t* ipconfig, unsigned char mac_address[6])
@@ -95,46 +121,286 @@ void uip_server_init(chanend xtcp[], int num_xtcp, xtcp_ipconfig_t* ipconfig, un
 #endif
 		xtcpd_init(xtcp, num_xtcp);
 	}
+
+	xtcp_timers_init();
 }
 
 static int needs_poll(xtcpd_state_t *s)
 {
+#if XTCP_ENABLE_TCP_SEND_WINDOW
+  if (s->s.send_credit)
+    return 1;
+#endif
   return (s->s.connect_request | s->s.send_request | s->s.abort_request | s->s.close_request | s->s.ack_request);
 }
 
-static int uip_conn_needs_poll(struct uip_conn *uip_conn)
+static int pending_requests(xtcpd_state_t *s)
 {
-  xtcpd_state_t *s = (xtcpd_state_t *) &(uip_conn->appstate);
-  return needs_poll(s);
+#if XTCP_ENABLE_TCP_SEND_WINDOW
+  return (s->s.connect_request + s->s.send_request + s->s.abort_request + s->s.close_request + s->s.ack_request + s->s.send_credit);
+#else
+  return (s->s.connect_request + s->s.send_request + s->s.abort_request + s->s.close_request + s->s.ack_request);
+#endif
 }
 
-static int uip_udp_conn_needs_poll(struct uip_udp_conn *uip_udp_conn)
+/* Connections with outstanding requests. TCP connections use slots
+   0..UIP_CONNS-1 and UDP connections the slots after that, so an idle
+   server only has to look at a couple of words. */
+#define NUM_POLL_SLOTS (UIP_CONNS + UIP_UDP_CONNS)
+#define POLL_MASK_WORDS ((NUM_POLL_SLOTS + 31) >> 5)
+
+static unsigned poll_pending[POLL_MASK_WORDS];
+
+void xtcpd_request_poll(xtcpd_state_t *s)
 {
-  xtcpd_state_t *s = (xtcpd_state_t *) &(uip_udp_conn->appstate);
-  return needs_poll(s);
+  char *p = (char *) s;
+  int i;
+
+  if (p >= (char *) &uip_conns[0] && p < (char *) &uip_conns[UIP_CONNS])
+    i = (p - (char *) &uip_conns[0]) / sizeof(struct uip_conn);
+  else
+    i = UIP_CONNS + (p - (char *) &uip_udp_conns[0]) / sizeof(struct uip_udp_conn);
+
+  poll_pending[i >> 5] |= 1 << (i & 31);
 }
 
-void xtcpd_check_connection_poll(void)
+/* Timers. Each TCP connection's timer runs only while the connection has
+   something to time, and each UDP connection's only while its application
+   asked for polls. */
+#define UIP_UDP_POLL_MS     100
+#define UIP_ARP_TIMER_MS    10000
+#define UIP_AUTOIP_TIMER_MS 500
+#define UIP_IGMP_TIMER_MS   100
+
+/* clock_time() has to be called at least this often to keep track of
+   the reference clock */
+#define UIP_TIMER_MAX_SLEEP_MS 1000
+
+#define DHCPC_CLIENT_PORT 68
+
+static struct uip_twheel_timer arp_tmr;
+#if UIP_USE_AUTOIP
+static struct uip_twheel_timer autoip_tmr;
+#endif
+#if UIP_IGMP
+static struct uip_twheel_timer igmp_tmr;
+#endif
+
+static void tcp_timer_update(struct uip_conn *conn)
 {
-	for (int i = 0; i < UIP_CONNS; i++) {
-		if (uip_conn_needs_poll(&uip_conns[i])) {
-			uip_poll_conn(&uip_conns[i]);
-			if (uip_len > 0) {
-				uip_arp_out( NULL);
-				xtcp_tx_buffer();
-			}
-		}
-	}
+  xtcpd_state_t *s = (xtcpd_state_t *) &(conn->appstate);
+  u8_t state = conn->tcpstateflags & UIP_TS_MASK;
+
+  // Unacknowledged data (or SYN/FIN), TIME_WAIT and FIN_WAIT_2 are timed,
+  // as is an idle connection whose application asked for polls
+  if (state == UIP_CLOSED)
+    uip_twheel_cancel(&conn->tick);
+  else if (state == UIP_ESTABLISHED && !uip_outstanding(conn)) {
+    if (s->s.poll_interval != 0) {
+      int left = s->s.tmr.start + s->s.tmr.interval - clock_time();
+      uip_twheel_arm(&conn->tick, left > 0 ? left : 0);
+    }
+    else
+      uip_twheel_cancel(&conn->tick);
+  }
+  else if (!uip_twheel_armed(&conn->tick))
+    uip_twheel_arm(&conn->tick, UIP_TCP_TICK_MS);
+}
 
-	for (int i = 0; i < UIP_UDP_CONNS; i++) {
-		if (uip_udp_conn_needs_poll(&uip_udp_conns[i])) {
-			uip_udp_periodic(i);
-			if (uip_len > 0) {
-				uip_arp_out(&uip_udp_conns[i]);
-				xtcp_tx_buffer();
-			}
-		}
-	}
+static void udp_timer_update(struct uip_udp_conn *conn)
+{
+  xtcpd_state_t *s = (xtcpd_state_t *) &(conn->appstate);
+
+  if (conn->lport == 0) {
+    uip_twheel_cancel(&conn->tick);
+  }
+  else if (conn->lport == HTONS(DHCPC_CLIENT_PORT)) {
+    // The DHCP client times its own retries off regular polls
+    if (!uip_twheel_armed(&conn->tick))
+      uip_twheel_arm(&conn->tick, UIP_UDP_POLL_MS);
+  }
+  else if (s->s.poll_interval != 0) {
+    int left = s->s.tmr.start + s->s.tmr.interval - clock_time();
+    uip_twheel_arm(&conn->tick, left > 0 ? left : 0);
+  }
+  else {
+    uip_twheel_cancel(&conn->tick);
+  }
+}
+
+static void tcp_tick(struct uip_twheel_timer *t)
+{
+  struct uip_conn *conn =
+    (struct uip_conn *) ((char *) t - offsetof(struct uip_conn, tick));
+
+  uip_periodic_conn(conn);
+  if (uip_len > 0) {
+    uip_arp_out(NULL);
+    xtcp_tx_buffer();
+  }
+  tcp_timer_update(conn);
+}
+
+#if UIP_DELAYED_ACK
+static void delack_tick(struct uip_twheel_timer *t)
+{
+  struct uip_conn *conn =
+    (struct uip_conn *) ((char *) t - offsetof(struct uip_conn, delack_tmr));
+
+  uip_delack_conn(conn);
+  if (uip_len > 0) {
+    uip_arp_out(NULL);
+    xtcp_tx_buffer();
+  }
+}
+#endif
+
+static void udp_tick(struct uip_twheel_timer *t)
+{
+  struct uip_udp_conn *conn =
+    (struct uip_udp_conn *) ((char *) t - offsetof(struct uip_udp_conn, tick));
+
+  uip_udp_periodic_conn(conn);
+  if (uip_len > 0) {
+    uip_arp_out(conn);
+    xtcp_tx_buffer();
+  }
+  udp_timer_update(conn);
+}
+
+static void arp_tick(struct uip_twheel_timer *t)
+{
+  uip_arp_timer();
+  uip_twheel_arm(t, UIP_ARP_TIMER_MS);
+}
+
+#if UIP_USE_AUTOIP
+static void autoip_tick(struct uip_twheel_timer *t)
+{
+  autoip_periodic();
+  if (uip_len > 0) {
+    xtcp_tx_buffer();
+  }
+  uip_twheel_arm(t, UIP_AUTOIP_TIMER_MS);
+}
+#endif
+
+#if UIP_IGMP
+static void igmp_tick(struct uip_twheel_timer *t)
+{
+  igmp_periodic();
+  if (uip_len > 0) {
+    xtcp_tx_buffer();
+  }
+  uip_twheel_arm(t, UIP_IGMP_TIMER_MS);
+}
+#endif
+
+static void xtcp_timers_init(void)
+{
+  uip_twheel_init();
+  for (int i = 0; i < UIP_CONNS; i++) {
+    uip_twheel_timer_init(&uip_conns[i].tick, tcp_tick);
+#if UIP_DELAYED_ACK
+    uip_twheel_timer_init(&uip_conns[i].delack_tmr, delack_tick);
+#endif
+  }
+  for (int i = 0; i < UIP_UDP_CONNS; i++)
+    uip_twheel_timer_init(&uip_udp_conns[i].tick, udp_tick);
+
+  uip_twheel_timer_init(&arp_tmr, arp_tick);
+  uip_twheel_arm(&arp_tmr, UIP_ARP_TIMER_MS);
+#if UIP_USE_AUTOIP
+  uip_twheel_timer_init(&autoip_tmr, autoip_tick);
+  uip_twheel_arm(&autoip_tmr, UIP_AUTOIP_TIMER_MS);
+#endif
+#if UIP_IGMP
+  uip_twheel_timer_init(&igmp_tmr, igmp_tick);
+  uip_twheel_arm(&igmp_tmr, UIP_IGMP_TIMER_MS);
+#endif
+
+  // Start polling the DHCP client
+  for (int i = 0; i < UIP_UDP_CONNS; i++)
+    udp_timer_update(&uip_udp_conns[i]);
+}
+
+void xtcp_process_timers(void)
+{
+  uip_twheel_run();
+}
+
+int xtcp_timer_next(void)
+{
+  return uip_twheel_next(UIP_TIMER_MAX_SLEEP_MS);
+}
+
+/* Poll a single connection. Returns non-zero if the poll sent a packet or
+   consumed one of the connection's requests. */
+static int poll_slot(int i)
+{
+  xtcpd_state_t *s;
+  int before;
+  int sent;
+
+  if (i < UIP_CONNS) {
+    struct uip_conn *conn = &uip_conns[i];
+    s = (xtcpd_state_t *) &(conn->appstate);
+    if (!needs_poll(s))
+      return 0;
+    before = pending_requests(s);
+    uip_poll_conn(conn);
+    sent = uip_len > 0;
+    if (sent) {
+      uip_arp_out( NULL);
+      xtcp_tx_buffer();
+    }
+    tcp_timer_update(conn);
+  }
+  else {
+    struct uip_udp_conn *conn = &uip_udp_conns[i - UIP_CONNS];
+    s = (xtcpd_state_t *) &(conn->appstate);
+    // The application may have changed its poll interval
+    udp_timer_update(conn);
+    if (!needs_poll(s))
+      return 0;
+    before = pending_requests(s);
+    uip_udp_periodic_conn(conn);
+    sent = uip_len > 0;
+    if (sent) {
+      uip_arp_out(conn);
+      xtcp_tx_buffer();
+    }
+    udp_timer_update(conn);
+  }
+  return sent || pending_requests(s) != before;
+}
+
+void xtcpd_check_connection_poll(void)
+{
+  int progress;
+
+  // Requests raised while polling (e.g. by clients serviced during a
+  // send) are picked up by another pass. Connections that cannot make
+  // progress stay marked until the next packet, timer tick or command.
+  do {
+    progress = 0;
+    for (int w = 0; w < POLL_MASK_WORDS; w++) {
+      unsigned pending = poll_pending[w];
+      poll_pending[w] = 0;
+      while (pending) {
+        int b = 31 - __builtin_clz(pending);
+        int i = (w << 5) + b;
+        pending &= ~(1 << b);
+        progress |= poll_slot(i);
+        if (i < UIP_CONNS) {
+          if (needs_poll((xtcpd_state_t *) &(uip_conns[i].appstate)))
+            poll_pending[w] |= 1 << b;
+        }
+        else if (needs_poll((xtcpd_state_t *) &(uip_udp_conns[i - UIP_CONNS].appstate)))
+          poll_pending[w] |= 1 << b;
+      }
+    }
+  } while (progress);
 }
 
 void xtcp_process_incoming_packet(int length)
@@ -143,6 +409,8 @@ void xtcp_process_incoming_packet(int length)
 		uip_len = length;
 		uip_arp_ipin();
 		uip_input();
+		if (uip_conn != NULL)
+			tcp_timer_update(uip_conn);
 		if (uip_len > 0) {
 			if (uip_udpconnection()
 				&& (TCPBUF->proto != UIP_PROTO_ICMP)
@@ -159,6 +427,11 @@ void xtcp_process_incoming_packet(int length)
 		if (uip_len > 0) {
 						xtcp_tx_buffer();
 		}
+#if UIP_ARP_QUEUE_LEN
+		// Send the packets that were waiting for this address
+		while (uip_arp_queue_out())
+			xtcp_tx_buffer();
+#endif
 		for (int i = 0; i < UIP_UDP_CONNS; i++) {
 			uip_udp_arp_event(i);
 			if (uip_len > 0) {
@@ -169,8 +442,47 @@ void xtcp_process_incoming_packet(int length)
 	}
 }
 
+extern void *uip_sappdata;
+
+static void *uip_buf_rebase(void *p, u8_t *old)
+{
+	u8_t *q = (u8_t *) p;
+	if (q >= old && q < old + UIP_BUFSIZE)
+		return uip_buf + (q - old);
+	return p;
+}
+
+void uip_buf_own(void)
+{
+	u8_t *old = uip_buf;
+
+	if (uip_buf_frame_size == 0)
+		return;
+
+	memcpy(uip_buf32, old, uip_buf_frame_size);
+	uip_buf = (u8_t *) &uip_buf32[0];
+	uip_buf_frame_size = 0;
+	uip_appdata = uip_buf_rebase(uip_appdata, old);
+	uip_sappdata = uip_buf_rebase(uip_sappdata, old);
+#if UIP_URGDATA > 0
+	uip_urgdata = uip_buf_rebase(uip_urgdata, old);
+#endif
+}
+
+void xtcp_process_incoming_frame(unsigned frame, int length)
+{
+	uip_buf = (u8_t *) frame;
+	uip_buf_frame_size = length < UIP_FRAME_MIN_SIZE ? UIP_FRAME_MIN_SIZE : length;
+	xtcp_process_incoming_packet(length);
+	uip_buf = (u8_t *) &uip_buf32[0];
+	uip_buf_frame_size = 0;
+}
+
 void xtcp_process_udp_acks(void)
 {
+	if (!uip_udp_acks_pending)
+		return;
+	uip_udp_acks_pending = 0;
 	for (int i = 0; i < UIP_UDP_CONNS; i++) {
 		if (uip_udp_conn_has_ack(&uip_udp_conns[i])) {
 			uip_udp_ackdata(i);
@@ -182,31 +494,6 @@ void xtcp_process_udp_acks(void)
 	}
 }
 
-void xtcp_process_periodic_timer(void)
-{
-#if UIP_IGMP
-	igmp_periodic();
-	if(uip_len > 0) {
-				xtcp_tx_buffer();
-	}
-#endif
-	for (int i = 0; i < UIP_UDP_CONNS; i++) {
-		uip_udp_periodic(i);
-		if (uip_len > 0) {
-			uip_arp_out(&uip_udp_conns[i]);
-			xtcp_tx_buffer();
-		}
-	}
-
-	for (int i = 0; i < UIP_CONNS; i++) {
-		uip_periodic(i);
-		if (uip_len > 0) {
-			uip_arp_out( NULL);
-			xtcp_tx_buffer();
-		}
-	}
-}
-
 #if UIP_USE_DHCP
 void dhcpc_configured(const struct dhcpc_state *s) {
 #ifdef XTCP_VERBOSE_DEBUG
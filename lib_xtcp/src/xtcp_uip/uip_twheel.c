@@ -0,0 +1,191 @@
+// Copyright (c) 2016, XMOS Ltd, All rights reserved
+
+#include <stddef.h>
+#include "uip_twheel.h"
+
+/* Three levels of 64 slots: 1ms, 64ms and 4.096s per slot. A timer sits
+   in the lowest level whose range covers it and is moved down a level
+   (cascaded) when time reaches the start of its slot. Timers further
+   out than the top level covers are parked in its last slot and
+   re-filed each time they are cascaded. */
+#define TW_BITS   6
+#define TW_SLOTS  (1 << TW_BITS)
+#define TW_MASK   (TW_SLOTS - 1)
+#define TW_LEVELS 3
+#define TW_RANGE  (1 << (TW_LEVELS * TW_BITS))
+
+#define TW_NEVER  0x7fffffff
+
+static struct uip_twheel_timer *wheel[TW_LEVELS][TW_SLOTS];
+static unsigned long long nonempty[TW_LEVELS];
+
+/* The next tick to run. Every earlier tick has been run. */
+static clock_time_t tw_now;
+
+#define tw_diff(a, b) ((int) ((unsigned) (a) - (unsigned) (b)))
+
+static void tw_insert(struct uip_twheel_timer *t)
+{
+  int delta = tw_diff(t->expires, tw_now);
+  unsigned when = t->expires;
+  int level, slot;
+
+  if (delta < 0) {
+    delta = 0;
+    when = tw_now;
+  }
+  if (delta < (1 << TW_BITS)) {
+    level = 0;
+  } else if (delta < (1 << (2 * TW_BITS))) {
+    level = 1;
+  } else {
+    level = 2;
+    if (delta >= TW_RANGE)
+      when = tw_now + TW_RANGE - 1;
+  }
+  slot = (when >> (level * TW_BITS)) & TW_MASK;
+
+  t->next = wheel[level][slot];
+  if (t->next)
+    t->next->pprev = &t->next;
+  t->pprev = &wheel[level][slot];
+  wheel[level][slot] = t;
+  nonempty[level] |= 1ULL << slot;
+}
+
+static void tw_unlink(struct uip_twheel_timer *t)
+{
+  struct uip_twheel_timer **pprev = t->pprev;
+
+  *pprev = t->next;
+  if (t->next)
+    t->next->pprev = pprev;
+  if (*pprev == NULL &&
+      pprev >= &wheel[0][0] && pprev < &wheel[0][0] + TW_LEVELS * TW_SLOTS) {
+    int i = pprev - &wheel[0][0];
+    nonempty[i >> TW_BITS] &= ~(1ULL << (i & TW_MASK));
+  }
+  t->next = NULL;
+  t->pprev = NULL;
+}
+
+/* Detach and return the list in a slot */
+static struct uip_twheel_timer *tw_take(int level, int slot)
+{
+  struct uip_twheel_timer *t = wheel[level][slot];
+
+  wheel[level][slot] = NULL;
+  nonempty[level] &= ~(1ULL << slot);
+  return t;
+}
+
+/* Distance from slot start to the first non-empty slot at a level,
+   wrapping round, or -1 if the level is empty */
+static int tw_first(int level, int start)
+{
+  unsigned long long m = nonempty[level];
+
+  if (m == 0)
+    return -1;
+  m = (m >> start) | (m << ((TW_SLOTS - start) & TW_MASK));
+  return __builtin_ctzll(m);
+}
+
+/* Ticks from tw_now to the next tick that has work to do */
+static int tw_next_event(void)
+{
+  int best = TW_NEVER;
+  int d;
+
+  d = tw_first(0, tw_now & TW_MASK);
+  if (d >= 0)
+    best = d;
+
+  for (int level = 1; level < TW_LEVELS; level++) {
+    int shift = level * TW_BITS;
+    unsigned unit = ((unsigned) tw_now + (1 << shift) - 1) >> shift;
+    d = tw_first(level, unit & TW_MASK);
+    if (d >= 0) {
+      d = tw_diff((unit + d) << shift, tw_now);
+      if (d < best)
+        best = d;
+    }
+  }
+  return best;
+}
+
+static void tw_tick(void)
+{
+  unsigned t = tw_now;
+  struct uip_twheel_timer *list;
+
+  for (int level = TW_LEVELS - 1; level > 0; level--) {
+    int shift = level * TW_BITS;
+    if ((t & ((1 << shift) - 1)) == 0) {
+      list = tw_take(level, (t >> shift) & TW_MASK);
+      while (list) {
+        struct uip_twheel_timer *next = list->next;
+        tw_insert(list);
+        list = next;
+      }
+    }
+  }
+
+  /* Run the due timers from a private list so that anything armed for
+     the current tick by their functions goes round again next tick */
+  list = tw_take(0, t & TW_MASK);
+  tw_now = t + 1;
+  if (list)
+    list->pprev = &list;
+  while (list) {
+    struct uip_twheel_timer *p = list;
+    tw_unlink(p);
+    p->fn(p);
+  }
+}
+
+void uip_twheel_init(void)
+{
+  tw_now = clock_time();
+}
+
+void uip_twheel_arm(struct uip_twheel_timer *t, clock_time_t delay)
+{
+  if (uip_twheel_armed(t))
+    tw_unlink(t);
+  t->expires = clock_time() + delay;
+  tw_insert(t);
+}
+
+void uip_twheel_cancel(struct uip_twheel_timer *t)
+{
+  if (uip_twheel_armed(t))
+    tw_unlink(t);
+}
+
+void uip_twheel_run(void)
+{
+  clock_time_t now = clock_time();
+
+  while (tw_diff(now, tw_now) >= 0) {
+    int d = tw_next_event();
+    if (d > tw_diff(now, tw_now)) {
+      tw_now = now + 1;
+      break;
+    }
+    tw_now += d;
+    tw_tick();
+  }
+}
+
+clock_time_t uip_twheel_next(clock_time_t max)
+{
+  int d = tw_next_event();
+
+  if (d == TW_NEVER)
+    return max;
+  d = tw_diff(tw_now + d, clock_time());
+  if (d < 0)
+    return 0;
+  return d < max ? d : max;
+}
@@ -0,0 +1,52 @@
+// Copyright (c) 2016, XMOS Ltd, All rights reserved
+
+#ifndef __UIP_TWHEEL_H__
+#define __UIP_TWHEEL_H__
+
+#include "clock.h"
+
+/**
+ * A timer on the timer wheel.
+ *
+ * Timers are kept in a hierarchical wheel with one millisecond
+ * resolution, so arming, cancelling and running a timer costs the same
+ * however many other timers are armed, and time with nothing due costs
+ * nothing at all. A timer is embedded in the structure that owns it and
+ * must be set up with uip_twheel_timer_init() before use.
+ */
+struct uip_twheel_timer {
+  struct uip_twheel_timer *next;
+  struct uip_twheel_timer **pprev;
+  clock_time_t expires;
+  void (*fn)(struct uip_twheel_timer *t);
+};
+
+#define uip_twheel_timer_init(t, f) do { (t)->next = 0; (t)->pprev = 0; \
+                                         (t)->fn = (f); } while (0)
+
+/** Non-zero if the timer is waiting to fire. */
+#define uip_twheel_armed(t) ((t)->pprev != 0)
+
+void uip_twheel_init(void);
+
+/**
+ * Arm a timer to call its function delay milliseconds from now. A timer
+ * that is already armed is moved.
+ */
+void uip_twheel_arm(struct uip_twheel_timer *t, clock_time_t delay);
+
+void uip_twheel_cancel(struct uip_twheel_timer *t);
+
+/**
+ * Call the function of every timer that is due. A timer is disarmed
+ * before its function is called, so the function may re-arm it.
+ */
+void uip_twheel_run(void);
+
+/**
+ * The number of milliseconds until uip_twheel_run() next has work to do,
+ * at most max.
+ */
+clock_time_t uip_twheel_next(clock_time_t max);
+
+#endif /* __UIP_TWHEEL_H__ */
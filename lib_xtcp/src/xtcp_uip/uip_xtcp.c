@@ -45,18 +45,17 @@ struct listener_info_t tcp_listeners[NUM_TCP_LISTENERS] = {{0}};
 struct listener_info_t udp_listeners[NUM_UDP_LISTENERS] = {{0}};
 
 
+// Maps a connection id to the state currently holding it. A state keeps
+// its id until it is reinitialised for a new connection.
+static xtcpd_state_t *guid_table[MAX_GUID+1];
+
 static struct xtcpd_state_t  *lookup_xtcpd_state(int conn_id) {
-  int i=0;
-  for (i=0;i<((UIP_CONNS>UIP_UDP_CONNS) ? UIP_CONNS : UIP_UDP_CONNS);i++) {
-    if (i < UIP_CONNS) {
-      xtcpd_state_t *s = (xtcpd_state_t *) &(uip_conns[i].appstate);
-      if (s->conn.id == conn_id) return s;
-    }
-    if (i < UIP_UDP_CONNS) {
-        xtcpd_state_t *s = (xtcpd_state_t *) &(uip_udp_conns[i].appstate);
-        if (s->conn.id == conn_id) return s;
-    }
-  }
+  xtcpd_state_t *s;
+  if (conn_id < 1 || conn_id > MAX_GUID)
+    return NULL;
+  s = guid_table[conn_id];
+  if (s != NULL && s->conn.id == conn_id)
+    return s;
   return NULL;
 }
 
@@ -112,6 +111,9 @@ void xtcpd_init_state(xtcpd_state_t *s,
     }
   }
 
+  if (lookup_xtcpd_state(s->conn.id) == s)
+    guid_table[s->conn.id] = NULL;
+
   memset(s, 0, sizeof(xtcpd_state_t));
 
   // Find and use a GUID that is not being used by another connection
@@ -121,6 +123,7 @@ void xtcpd_init_state(xtcpd_state_t *s,
     if (guid > MAX_GUID)
       guid = 1;
   }
+  guid_table[guid] = s;
 
   s->conn.connection_type = connection_type;
   s->linknum = linknum;
@@ -208,8 +211,12 @@ void xtcpd_bind_local(int linknum, int conn_id, int port_number)
   s->conn.local_port = port_number;
   if (s->conn.protocol == XTCP_PROTOCOL_UDP)
     ((struct uip_udp_conn *) s->s.uip_conn)->lport = HTONS(port_number);
-  else
-    ((struct uip_conn *) s->s.uip_conn)->lport = HTONS(port_number);
+  else {
+    struct uip_conn *conn = (struct uip_conn *) s->s.uip_conn;
+    conn->lport = HTONS(port_number);
+    // Incoming segments are found by the new port from now on
+    uip_conn_hash_insert(conn);
+  }
 }
 
 void xtcpd_bind_remote(int linknum,
@@ -239,6 +246,7 @@ void xtcpd_connect(int linknum, int port_number, xtcp_ipaddr_t addr,
          s->linknum = linknum;
          s->s.connect_request = 1;
          s->conn.connection_type = XTCP_CLIENT_CONNECTION;
+         xtcpd_request_poll(s);
        }
   }
   else {
@@ -249,6 +257,7 @@ void xtcpd_connect(int linknum, int port_number, xtcp_ipaddr_t addr,
       s->linknum = linknum;
       s->s.connect_request = 1;
       s->conn.connection_type = XTCP_CLIENT_CONNECTION;
+      xtcpd_request_poll(s);
     }
   }
   return;
@@ -261,6 +270,7 @@ void xtcpd_init_send(int linknum, int conn_id)
 
   if (s != NULL) {
     s->s.send_request++;
+    xtcpd_request_poll(s);
   }
 }
 
@@ -269,7 +279,21 @@ void xtcpd_init_send_from_uip(struct uip_conn *conn)
 {
   xtcpd_state_t *s = &(conn->appstate);
   s->s.send_request++;
+  xtcpd_request_poll(s);
+}
+
+#if XTCP_ENABLE_TCP_SEND_WINDOW
+/* Called by uIP when the connection can take more data before the
+   previous data has been acknowledged. */
+void xtcpd_send_credit_from_uip(struct uip_conn *conn)
+{
+  xtcpd_state_t *s = &(conn->appstate);
+  if (conn->fin_pending)
+    return;
+  s->s.send_credit = 1;
+  xtcpd_request_poll(s);
 }
+#endif
 
 void xtcpd_set_appstate(int linknum, int conn_id, xtcp_appstate_t appstate)
 {
@@ -285,6 +309,7 @@ void xtcpd_abort(int linknum, int conn_id)
   xtcpd_state_t *s = lookup_xtcpd_state(conn_id);
   if (s != NULL) {
     s->s.abort_request = 1;
+    xtcpd_request_poll(s);
   }
 }
 
@@ -293,6 +318,7 @@ void xtcpd_close(int linknum, int conn_id)
   xtcpd_state_t *s = lookup_xtcpd_state(conn_id);
   if (s != NULL) {
     s->s.close_request = 1;
+    xtcpd_request_poll(s);
   }
 }
 
@@ -308,8 +334,13 @@ void xtcpd_ack_recv(int conn_id)
 {
   xtcpd_state_t *s = lookup_xtcpd_state(conn_id);
   if (s != NULL) {
+#if XTCP_ENABLE_SHARED_RECV
+    if (s->s.rx_buf_full)
+      return;
+#endif
     ((struct uip_conn *) s->s.uip_conn)->tcpstateflags &= ~UIP_STOPPED;
     s->s.ack_request = 1;
+    xtcpd_request_poll(s);
   }
 }
 
@@ -327,8 +358,13 @@ void xtcpd_unpause(int conn_id)
 {
   xtcpd_state_t *s = lookup_xtcpd_state(conn_id);
   if (s != NULL) {
+#if XTCP_ENABLE_SHARED_RECV
+    if (s->s.rx_buf_full)
+      return;
+#endif
     ((struct uip_conn *) s->s.uip_conn)->tcpstateflags &= ~UIP_STOPPED;
     s->s.ack_request = 1;
+    xtcpd_request_poll(s);
   }
 }
 
@@ -342,6 +378,76 @@ void xtcpd_accept_partial_ack(int conn_id)
 }
 #endif
 
+#if XTCP_ENABLE_SHARED_RECV
+void xtcpd_shared_recv_mode(int conn_id, unsigned buf, int len)
+{
+  xtcpd_state_t *s = lookup_xtcpd_state(conn_id);
+  if (s != NULL && s->conn.protocol == XTCP_PROTOCOL_TCP &&
+      len >= XTCP_CLIENT_BUF_SIZE) {
+    xtcp_bufinfo_t *bufinfo = (xtcp_bufinfo_t *) s->s.rx_bufinfo;
+    bufinfo->rx_buf = (char *) buf;
+    bufinfo->rx_end = (char *) buf + len;
+    bufinfo->rx_wrptr = bufinfo->rx_buf;
+    bufinfo->rx_rdptr = bufinfo->rx_buf;
+  }
+}
+
+void xtcpd_shared_recv_ack(int conn_id, int len)
+{
+  xtcpd_state_t *s = lookup_xtcpd_state(conn_id);
+  if (s != NULL) {
+    xtcp_bufinfo_t *bufinfo = (xtcp_bufinfo_t *) s->s.rx_bufinfo;
+    if (bufinfo->rx_buf == NULL)
+      return;
+
+    bufinfo->rx_rdptr += len;
+    if (bufinfo->rx_rdptr >= bufinfo->rx_wrptr) {
+      // Everything has been released so start filling from the
+      // beginning again
+      bufinfo->rx_rdptr = bufinfo->rx_buf;
+      bufinfo->rx_wrptr = bufinfo->rx_buf;
+    }
+
+    if (s->s.rx_buf_full &&
+        bufinfo->rx_end - bufinfo->rx_wrptr >= XTCP_CLIENT_BUF_SIZE) {
+      s->s.rx_buf_full = 0;
+      ((struct uip_conn *) s->s.uip_conn)->tcpstateflags &= ~UIP_STOPPED;
+      s->s.ack_request = 1;
+      xtcpd_request_poll(s);
+    }
+  }
+}
+
+/* Copy newly received data into the client's shared buffer and pass the
+ * client a pointer to it. The buffer is filled linearly and rewound once
+ * the client has released everything so each segment is contiguous. The
+ * window is closed while there is no room for another full segment.
+ */
+static int xtcpd_shared_recv(xtcpd_state_t *s)
+{
+  xtcp_bufinfo_t *bufinfo = (xtcp_bufinfo_t *) s->s.rx_bufinfo;
+  char *data;
+
+  if (bufinfo->rx_buf == NULL)
+    return 0;
+
+  data = bufinfo->rx_wrptr;
+  memcpy(data, uip_appdata, uip_datalen());
+  bufinfo->rx_wrptr += uip_datalen();
+
+  xtcpd_recv_shared(xtcp_links, s->linknum, xtcp_num,
+                    s,
+                    (unsigned) data,
+                    uip_datalen());
+
+  if (bufinfo->rx_end - bufinfo->rx_wrptr < XTCP_CLIENT_BUF_SIZE) {
+    s->s.rx_buf_full = 1;
+    uip_stop();
+  }
+  return 1;
+}
+#endif
+
 extern u16_t uip_slen;
 
 static int do_xtcpd_send(chanend c,
@@ -425,7 +531,26 @@ void uip_xtcpd_handle_poll(xtcpd_state_t *s)
       s->s.connect_request = 0;
     }
   }
+#if XTCP_ENABLE_TCP_SEND_WINDOW
+  else if (s->s.send_credit) {
+    int len;
+    s->s.send_credit = 0;
+    if (s->linknum != -1 && !uip_conn->fin_pending) {
+      len = do_xtcpd_send(xtcp_links[s->linknum],
+                          XTCP_SENT_DATA,
+                          s,
+                          uip_appdata,
+                          uip_mss());
+      uip_send(uip_appdata, len);
+    }
+  }
+#endif
+#if XTCP_ENABLE_TCP_SEND_WINDOW
+  // Only ask for data once the connection can take some of it
+  else if (s->s.send_request && (uip_udpconnection() || uip_mss() != 0)) {
+#else
   else if (s->s.send_request) {
+#endif
     int len;
     if (s->linknum != -1) {
       len = do_xtcpd_send(xtcp_links[s->linknum],
@@ -461,6 +586,7 @@ xtcpd_appcall(void)
       (uip_udp_conn->lport == HTONS(DHCPC_CLIENT_PORT) ||
        uip_udp_conn->lport == HTONS(DHCPC_SERVER_PORT))) {
 #if UIP_USE_DHCP
+    uip_buf_own();
     dhcpc_appcall();
 #endif
     return;
@@ -513,6 +639,9 @@ xtcpd_appcall(void)
 
       xtcpd_service_clients_until_ready(s->linknum, xtcp_links, xtcp_num);
 
+#if XTCP_ENABLE_SHARED_RECV
+      if (uip_udpconnection() || !xtcpd_shared_recv(s))
+#endif
       xtcpd_recv(xtcp_links, s->linknum, xtcp_num,
                  s,
                  uip_appdata,
@@ -535,9 +664,32 @@ xtcpd_appcall(void)
   }
 
 
+  // Anything sent from here on may not fit in the received frame
+  if (uip_acked() || uip_rexmit() || uip_poll())
+    uip_buf_own();
+
   if (uip_acked()) {
     int len;
+#if XTCP_ENABLE_TCP_SEND_WINDOW
+    int ask = 1;
+    if (!uip_udpconnection()) {
+      s->s.send_credit = 0;
+      if (uip_conn->fin_pending) {
+        // The client has closed the connection so it is not asked for
+        // more data, the FIN follows once everything is acknowledged
+        ask = 0;
+      }
+      else if (uip_mss() == 0) {
+        // No room for more data yet, ask again when there is
+        s->s.send_credit = 1;
+        xtcpd_request_poll(s);
+        ask = 0;
+      }
+    }
+    if (s->linknum != -1 && ask) {
+#else
     if (s->linknum != -1) {
+#endif
       len =
         do_xtcpd_send(xtcp_links[s->linknum],
                       XTCP_SENT_DATA,
@@ -589,6 +741,7 @@ xtcpd_appcall(void)
 }
 
 static int uip_ifstate = 0;
+static int ifstate_changed = 1;
 
 
 void xtcpd_get_ipconfig(xtcp_ipconfig_t *ipconfig)
@@ -622,6 +775,10 @@ void uip_xtcp_checkstate()
 {
   int i;
 
+  if (!ifstate_changed)
+    return;
+  ifstate_changed = 0;
+
   for (i=0;i<xtcp_num;i++) {
     if (uip_ifstate != prev_ifstate[i]) {
       uip_xtcpd_send_config(i);
@@ -634,10 +791,12 @@ void uip_xtcp_checkstate()
 
 void uip_xtcp_up() {
   uip_ifstate = 1;
+  ifstate_changed = 1;
 }
 
 void uip_xtcp_down() {
   uip_ifstate = 0;
+  ifstate_changed = 1;
 }
 
 
@@ -650,9 +809,11 @@ int get_uip_xtcp_ifstate()
 void xtcpd_set_poll_interval(int linknum, int conn_id, int poll_interval)
 {
   xtcpd_state_t *s = lookup_xtcpd_state(conn_id);
-  if (s != NULL && s->conn.protocol == XTCP_PROTOCOL_UDP) {
+  if (s != NULL) {
     s->s.poll_interval = poll_interval;
     uip_timer_set(&(s->s.tmr), poll_interval * CLOCK_SECOND/1000);
+    // Picks up the new interval
+    xtcpd_request_poll(s);
   }
 }
 
@@ -12,4 +12,8 @@ void uip_linkdown();
 void uip_linkup();
 void uip_xtcp_null_events();
 
+#ifndef __XC__
+void xtcpd_request_poll(xtcpd_state_t *s);
+#endif
+
 #endif // _UIP_XTCP_H_
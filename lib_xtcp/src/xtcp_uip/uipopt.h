@@ -281,12 +281,46 @@
  */
 #define UIP_URGDATA      0
 
+/**
+ * The period of a connection's TCP timer in milliseconds.
+ *
+ * Retransmission timeouts are measured and counted in these ticks. A
+ * connection's timer only runs while it has something to time, such as
+ * unacknowledged data or a TIME_WAIT.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_TCP_TICK_MS
+#define UIP_TCP_TICK_MS UIP_CONF_TCP_TICK_MS
+#else
+#define UIP_TCP_TICK_MS 10
+#endif
+
+/** Convert milliseconds to TCP timer ticks, rounding up. */
+#define UIP_TCP_TICKS(ms) (((ms) + UIP_TCP_TICK_MS - 1) / UIP_TCP_TICK_MS)
+
 /**
  * The initial retransmission timeout counted in timer pulses.
  *
  * This should not be changed.
  */
-#define UIP_RTO         3
+#define UIP_RTO         UIP_TCP_TICKS(300)
+
+/**
+ * The smallest retransmission timeout the RTT estimate may give,
+ * counted in timer pulses.
+ *
+ * Peers that delay their ACKs can take up to 200ms to acknowledge a
+ * single segment, so going much lower than that causes spurious
+ * retransmissions with them.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_RTO_MIN_MS
+#define UIP_RTO_MIN     UIP_TCP_TICKS(UIP_CONF_RTO_MIN_MS)
+#else
+#define UIP_RTO_MIN     UIP_TCP_TICKS(200)
+#endif
 
 /**
  * The maximum number of times a segment should be retransmitted
@@ -328,13 +362,155 @@
 #define UIP_RECEIVE_WINDOW UIP_CONF_RECEIVE_WINDOW
 #endif
 
+/**
+ * The maximum segment size advertised to the remote host, which bounds
+ * the size of every segment received.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_RECEIVE_MSS
+#define UIP_RECEIVE_MSS (UIP_CONF_RECEIVE_MSS < UIP_TCP_MSS ? \
+                         UIP_CONF_RECEIVE_MSS : UIP_TCP_MSS)
+#else
+#define UIP_RECEIVE_MSS UIP_TCP_MSS
+#endif
+
+/**
+ * The window scale shift that lets UIP_RECEIVE_WINDOW be advertised in
+ * the 16 bit window field (RFC 7323). The option is only sent when the
+ * receive window is larger than 64kB.
+ */
+#define UIP_RCV_WSCALE ((UIP_RECEIVE_WINDOW) <= 0xffffL ? 0 : \
+                        (UIP_RECEIVE_WINDOW) <= 0x1ffffL ? 1 : \
+                        (UIP_RECEIVE_WINDOW) <= 0x3ffffL ? 2 : \
+                        (UIP_RECEIVE_WINDOW) <= 0x7ffffL ? 3 : \
+                        (UIP_RECEIVE_WINDOW) <= 0xfffffL ? 4 : 5)
+
+/**
+ * Hold on to segments that arrive ahead of a missing one instead of
+ * dropping them, and advertise the SACK permitted option so the remote
+ * host is told which segments are held (RFC 2018). Once the missing
+ * segment arrives the held ones are passed to the application straight
+ * away, so a single lost frame costs one retransmission rather than the
+ * whole window.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_TCP_OOO
+#define UIP_TCP_OOO UIP_CONF_TCP_OOO
+#else
+#define UIP_TCP_OOO 0
+#endif
+
+/**
+ * The number of out of order segments held, shared between all
+ * connections. Each takes UIP_RECEIVE_MSS bytes.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_TCP_OOO_SEGMENTS
+#define UIP_TCP_OOO_SEGMENTS UIP_CONF_TCP_OOO_SEGMENTS
+#else
+#define UIP_TCP_OOO_SEGMENTS 4
+#endif
+
+/**
+ * The number of hash buckets used to look up the connection an
+ * incoming TCP segment belongs to. Must be a power of two.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_CONN_HASH_SIZE
+#define UIP_CONN_HASH_SIZE UIP_CONF_CONN_HASH_SIZE
+#else
+#define UIP_CONN_HASH_SIZE 16
+#endif
+
+/**
+ * Allow several segments to be in flight on a TCP connection.
+ *
+ * Sent data is kept in a per-connection retransmit buffer so that the
+ * application does not have to regenerate it on a retransmission.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_TCP_SEND_WINDOW
+#define UIP_TCP_SEND_WINDOW UIP_CONF_TCP_SEND_WINDOW
+#else
+#define UIP_TCP_SEND_WINDOW 0
+#endif
+
+/**
+ * The size of the per-connection retransmit buffer in bytes. This
+ * limits the amount of unacknowledged data on a connection.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_TCP_SEND_BUFFER_SIZE
+#define UIP_TCP_SEND_BUFFER_SIZE UIP_CONF_TCP_SEND_BUFFER_SIZE
+#else
+#define UIP_TCP_SEND_BUFFER_SIZE (4 * UIP_TCP_MSS)
+#endif
+
+/**
+ * Delay ACKs for received data, as described in RFC 1122 section
+ * 4.2.3.2.
+ *
+ * Instead of acknowledging every segment, an ACK is sent for every
+ * second full-sized segment or UIP_DELACK_MS after the first
+ * unacknowledged one, whichever is sooner. In the meantime it is
+ * carried for free by any data the application sends back.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_DELAYED_ACK
+#define UIP_DELAYED_ACK UIP_CONF_DELAYED_ACK
+#else
+#define UIP_DELAYED_ACK 0
+#endif
+
+/**
+ * Leave IPv4, TCP and UDP checksums to the network device.
+ *
+ * Received packets are not checked again when the device reports that
+ * it verified them, and outgoing packets are sent with their checksums
+ * for the device to fill in. Only IPv4 is supported.
+ *
+ * \hideinitializer
+ */
+#if defined(UIP_CONF_CHECKSUM_OFFLOAD) && !UIP_CONF_IPV6
+#define UIP_CHECKSUM_OFFLOAD UIP_CONF_CHECKSUM_OFFLOAD
+#else
+#define UIP_CHECKSUM_OFFLOAD 0
+#endif
+
+/**
+ * The longest an ACK is held back in milliseconds. RFC 1122 requires
+ * this to be less than 500ms.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_DELACK_MS
+#define UIP_DELACK_MS UIP_CONF_DELACK_MS
+#else
+#define UIP_DELACK_MS 40
+#endif
+
+/**
+ * The number of unacknowledged bytes that makes an ACK go out at
+ * once: two full-sized segments, or the whole receive window if that
+ * is smaller so the peer is never left waiting for the timer.
+ */
+#define UIP_DELACK_BYTES (UIP_RECEIVE_WINDOW < 2 * UIP_RECEIVE_MSS ? \
+                          UIP_RECEIVE_WINDOW : 2 * UIP_RECEIVE_MSS)
+
 /**
  * How long a connection should stay in the TIME_WAIT state.
  *
  * This configiration option has no real implication, and it should be
  * left untouched.
  */
-#define UIP_TIME_WAIT_TIMEOUT 120
+#define UIP_TIME_WAIT_TIMEOUT UIP_TCP_TICKS(12000)
 
 
 /** @} */
@@ -358,6 +534,43 @@
 #define UIP_ARPTAB_SIZE 8
 #endif
 
+/**
+ * The number of hash buckets used to look up ARP table entries. Must
+ * be a power of two.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_ARP_HASH_SIZE
+#define UIP_ARP_HASH_SIZE UIP_CONF_ARP_HASH_SIZE
+#else
+#define UIP_ARP_HASH_SIZE 16
+#endif
+
+/**
+ * The number of outgoing packets that can wait for an ARP reply, or 0
+ * to drop a packet whose destination is not in the ARP table. Each
+ * takes UIP_BUFSIZE bytes.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_ARP_QUEUE_LEN
+#define UIP_ARP_QUEUE_LEN UIP_CONF_ARP_QUEUE_LEN
+#else
+#define UIP_ARP_QUEUE_LEN 0
+#endif
+
+/**
+ * The number of packets to a single destination that can wait for an
+ * ARP reply.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_ARP_QUEUE_PER_DEST
+#define UIP_ARP_QUEUE_PER_DEST UIP_CONF_ARP_QUEUE_PER_DEST
+#else
+#define UIP_ARP_QUEUE_PER_DEST 2
+#endif
+
 /**
  * The maxium age of ARP table entries measured in 10ths of seconds.
  *
@@ -8,5 +8,10 @@
 void xcoredev_init(chanend mac_rx, chanend mac_tx);
 unsigned int xcoredev_read(chanend mac_rx, int n);
 void xcoredev_send();
+void xcoredev_tx_done(void);
+
+/* Copy the frame being sent into dst: the headers in uip_buf followed
+   by any payload fragments. */
+void uip_tx_gather(unsigned char dst[]);
 
 #endif /* __XCOREDEV_H__ */
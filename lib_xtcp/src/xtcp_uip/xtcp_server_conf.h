@@ -2,6 +2,7 @@
 
 #include "uip_timer.h"
 #include "xtcp.h"
+#include "xtcp_bufinfo.h"
 
 typedef struct xtcp_server_state_t {
   int send_request;
@@ -17,4 +18,11 @@ typedef struct xtcp_server_state_t {
 #ifdef XTCP_ENABLE_PARTIAL_PACKET_ACK
   int accepts_partial_ack;
 #endif
+#if XTCP_ENABLE_TCP_SEND_WINDOW
+  int send_credit;
+#endif
+#if XTCP_ENABLE_SHARED_RECV
+  int rx_bufinfo[SIZEOF_BUFINFO/4]; // xtcp_bufinfo_t of the shared receive buffer
+  int rx_buf_full;
+#endif
 } xtcp_server_state_t;
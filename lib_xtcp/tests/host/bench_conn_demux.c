@@ -0,0 +1,123 @@
+// Host microbenchmark of the TCP input demultiplexer.
+//
+// Fills every uip_conns slot with an established connection and feeds
+// uip_input() pure ACKs addressed to each in turn, reporting the time
+// per segment. Built once with the default hash size and once with
+// UIP_CONF_CONN_HASH_SIZE=1, where every connection shares one chain,
+// to compare against a linear search of the connection table. The
+// receive checksums are marked as verified so that they do not hide
+// the cost of the lookup.
+//
+// It also checks that a connection whose local port is rebound is
+// found by its new port and no longer by its old one.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "uip.h"
+
+#define BUF ((struct uip_tcpip_hdr *)&uip_buf[UIP_LLH_LEN])
+
+#define LOCAL_PORT   80
+#define REMOTE_PORT0 40000
+#define SEGMENTS     2000000
+
+#define TCP_ACK 0x10
+
+static uip_ipaddr_t local_addr, remote_addr;
+
+static void open_conn(struct uip_conn *conn, int rport)
+{
+  memset(conn, 0, sizeof(*conn));
+  conn->tcpstateflags = UIP_ESTABLISHED;
+  conn->lport = HTONS(LOCAL_PORT);
+  conn->rport = HTONS(rport);
+  uip_ipaddr_copy(conn->ripaddr, remote_addr);
+  conn->mss = conn->initialmss = UIP_TCP_MSS;
+  conn->rto = conn->timer = UIP_RTO;
+  uip_conn_hash_insert(conn);
+}
+
+static void build_ack(int lport, int rport)
+{
+  memset(BUF, 0, UIP_TCPIP_HLEN);
+  BUF->vhl = 0x45;
+  BUF->len[1] = UIP_TCPIP_HLEN;
+  BUF->ttl = UIP_TTL;
+  BUF->proto = UIP_PROTO_TCP;
+  uip_ipaddr_copy(BUF->srcipaddr, remote_addr);
+  uip_ipaddr_copy(BUF->destipaddr, local_addr);
+  BUF->srcport = HTONS(rport);
+  BUF->destport = HTONS(lport);
+  BUF->tcpoffset = 5 << 4;
+  BUF->flags = TCP_ACK;
+  BUF->wnd[0] = 0x10;
+}
+
+// Returns the connection that the segment was delivered to, if any
+static struct uip_conn *deliver(void)
+{
+  uip_conn = NULL;
+  uip_len = UIP_TCPIP_HLEN;
+  uip_input();
+  return uip_conn;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void)
+{
+  int i;
+  double t;
+  struct uip_conn *rebound = &uip_conns[UIP_CONNS / 2];
+
+  uip_init();
+  uip_ipaddr(local_addr, 10, 0, 0, 1);
+  uip_ipaddr(remote_addr, 10, 0, 0, 2);
+  uip_sethostaddr(local_addr);
+#if UIP_CHECKSUM_OFFLOAD
+  uip_rx_chksum_ok = UIP_RX_IPCHKSUM_OK | UIP_RX_L4CHKSUM_OK;
+#endif
+
+  for (i = 0; i < UIP_CONNS; i++)
+    open_conn(&uip_conns[i], REMOTE_PORT0 + i);
+
+  for (i = 0; i < UIP_CONNS; i++) {
+    build_ack(LOCAL_PORT, REMOTE_PORT0 + i);
+    if (deliver() != &uip_conns[i]) {
+      printf("FAIL: segment for connection %d not delivered to it\n", i);
+      return 1;
+    }
+  }
+
+  rebound->lport = HTONS(LOCAL_PORT + 1);
+  uip_conn_hash_insert(rebound);
+  build_ack(LOCAL_PORT + 1, HTONS(rebound->rport));
+  if (deliver() != rebound) {
+    printf("FAIL: rebound connection not found by its new port\n");
+    return 1;
+  }
+  build_ack(LOCAL_PORT, HTONS(rebound->rport));
+  if (deliver() != NULL) {
+    printf("FAIL: rebound connection still found by its old port\n");
+    return 1;
+  }
+  rebound->lport = HTONS(LOCAL_PORT);
+  uip_conn_hash_insert(rebound);
+
+  t = now();
+  for (i = 0; i < SEGMENTS; i++) {
+    build_ack(LOCAL_PORT, REMOTE_PORT0 + i % UIP_CONNS);
+    deliver();
+  }
+  t = now() - t;
+
+  printf("%d connections, %d hash buckets: %.1f ns/segment\n",
+         UIP_CONNS, UIP_CONN_HASH_SIZE, t * 1e9 / SEGMENTS);
+  return 0;
+}
@@ -0,0 +1,14 @@
+// Stand-ins for the parts of the xtcp server that uip.c calls into, so
+// that the stack can be driven directly from a host program.
+#include "uip.h"
+
+static u32_t host_buf32[(UIP_BUFSIZE + 5) >> 2];
+u8_t *uip_buf = (u8_t *) &host_buf32[0];
+
+void xtcpd_appcall(void)
+{
+}
+
+void xtcpd_send_credit_from_uip(struct uip_conn *conn)
+{
+}
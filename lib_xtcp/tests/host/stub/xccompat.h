@@ -0,0 +1,18 @@
+/* Host build stand-in for the XC compatibility macros. */
+#ifndef XCCOMPAT_HOST_STUB_H_
+#define XCCOMPAT_HOST_STUB_H_
+
+typedef unsigned chanend;
+typedef unsigned port;
+typedef unsigned timer;
+typedef unsigned streaming_chanend_t;
+
+#define REFERENCE_PARAM(t,n) t *n
+#define NULLABLE_REFERENCE_PARAM(t,n) t *n
+#define NULLABLE_RESOURCE(t,n) t n
+#define CLIENT_INTERFACE(t,n) unsigned n
+#define NULLABLE_CLIENT_INTERFACE(t,n) unsigned n
+#define NULLABLE_ARRAY_OF(t,n) t *n
+#define ARRAY_OF_SIZE(t,n,s) t *n
+
+#endif
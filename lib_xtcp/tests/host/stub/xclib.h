@@ -0,0 +1,8 @@
+/* Host build stand-in for the xCORE intrinsics used by the code under
+   test. */
+#ifndef XCLIB_HOST_STUB_H_
+#define XCLIB_HOST_STUB_H_
+
+static inline unsigned byterev(unsigned x) { return __builtin_bswap32(x); }
+
+#endif
@@ -0,0 +1,105 @@
+// Host test of the queue of packets waiting for an ARP reply.
+//
+// Packets to one destination must go out in the order they were queued,
+// even when a later one took a slot ahead of an earlier one. A queued
+// frame must not be checksummed with a payload sum that uip_process()
+// left for another packet. uip.c is included so that this sum can be
+// seen.
+#include <stdio.h>
+#include <string.h>
+#include "uip.c"
+#include "uip_arp.h"
+
+#define IPBUF ((struct uip_tcpip_hdr *)&uip_buf[UIP_LLH_LEN])
+#define ARPBUF ((struct arp_reply *)&uip_buf[0])
+
+struct arp_reply {
+  struct uip_eth_hdr ethhdr;
+  u16_t hwtype, protocol;
+  u8_t hwlen, protolen;
+  u16_t opcode;
+  struct uip_eth_addr shwaddr;
+  u16_t sipaddr[2];
+  struct uip_eth_addr dhwaddr;
+  u16_t dipaddr[2];
+};
+
+void uip_buf_own(void)
+{
+}
+
+void autoip_arp_in(void)
+{
+}
+
+// Builds a TCP packet to 10.0.0.<host> whose first payload byte is tag,
+// and hands it to ARP as uip_process() output would be
+static void send_to(int host, u8_t tag)
+{
+  memset(uip_buf, 0, UIP_LLH_LEN + UIP_TCPIP_HLEN + 1);
+  IPBUF->vhl = 0x45;
+  IPBUF->len[1] = UIP_TCPIP_HLEN + 1;
+  IPBUF->proto = UIP_PROTO_TCP;
+  uip_ipaddr(IPBUF->srcipaddr, 10, 0, 0, 1);
+  uip_ipaddr(IPBUF->destipaddr, 10, 0, 0, host);
+  IPBUF->tcpoffset = 5 << 4;
+  uip_buf[UIP_LLH_LEN + UIP_TCPIP_HLEN] = tag;
+  uip_len = UIP_TCPIP_HLEN + 1;
+  uip_arp_out(NULL);
+}
+
+static void reply_from(int host)
+{
+  memset(uip_buf, 0, sizeof(struct arp_reply));
+  ARPBUF->opcode = HTONS(2);
+  uip_ipaddr(ARPBUF->sipaddr, 10, 0, 0, host);
+  ARPBUF->shwaddr.addr[5] = host;
+  uip_ipaddr(ARPBUF->dipaddr, 10, 0, 0, 1);
+  uip_len = sizeof(struct arp_reply);
+  uip_arp_arpin();
+}
+
+// The tag of the next frame flushed from the queue, or -1
+static int flush_one(void)
+{
+  uip_payload_len = 1;
+  if (!uip_arp_queue_out())
+    return -1;
+  if (uip_payload_len != 0) {
+    printf("FAIL: payload sum kept for a queued frame\n");
+    return -2;
+  }
+  return uip_buf[UIP_LLH_LEN + UIP_TCPIP_HLEN];
+}
+
+#define CHECK(c) do { if (!(c)) { \
+    printf("FAIL: line %d: %s\n", __LINE__, #c); return 1; } } while (0)
+
+int main(void)
+{
+  uip_ipaddr_t addr;
+
+  uip_init();
+  uip_arp_init();
+  uip_ipaddr(addr, 10, 0, 0, 1);
+  uip_sethostaddr(addr);
+  uip_ipaddr(addr, 255, 255, 255, 0);
+  uip_setnetmask(addr);
+
+  // Free the first slot once the second is taken, and queue the second
+  // packet to host 2 into it
+  send_to(3, 30);
+  send_to(2, 1);
+  reply_from(3);
+  CHECK(flush_one() == 30);
+  CHECK(flush_one() == -1);
+  send_to(2, 2);
+
+  reply_from(2);
+  CHECK(flush_one() == 1);
+  CHECK(flush_one() == 2);
+  CHECK(flush_one() == -1);
+
+  printf("test_arp_queue: pass\n");
+  return 0;
+}
@@ -0,0 +1,106 @@
+// Host test of delayed ACK state across the end of a connection.
+//
+// A connection that is holding back an ACK when it is reset must drop
+// it, and a connection slot that is reused must not start out with an
+// ACK left over from its last connection.
+#include <stdio.h>
+#include <string.h>
+#include "uip.h"
+
+#define BUF ((struct uip_tcpip_hdr *)&uip_buf[UIP_LLH_LEN])
+
+#define LOCAL_PORT  80
+#define REMOTE_PORT 40000
+#define DATA_LEN    100
+
+#define TCP_RST 0x04
+#define TCP_SYN 0x02
+#define TCP_ACK 0x10
+
+static uip_ipaddr_t local_addr, remote_addr;
+
+clock_time_t clock_time(void)
+{
+  return 0;
+}
+
+static void delack_tick(struct uip_twheel_timer *t)
+{
+}
+
+static void open_conn(struct uip_conn *conn)
+{
+  memset(conn, 0, sizeof(*conn));
+  uip_twheel_timer_init(&conn->delack_tmr, delack_tick);
+  conn->tcpstateflags = UIP_ESTABLISHED;
+  conn->lport = HTONS(LOCAL_PORT);
+  conn->rport = HTONS(REMOTE_PORT);
+  uip_ipaddr_copy(conn->ripaddr, remote_addr);
+  conn->mss = conn->initialmss = UIP_TCP_MSS;
+  conn->rto = conn->timer = UIP_RTO;
+  uip_conn_hash_insert(conn);
+}
+
+// Delivers a segment from the remote host with len bytes of data
+static void deliver(struct uip_conn *conn, u8_t flags, int len)
+{
+  memset(BUF, 0, UIP_TCPIP_HLEN + len);
+  BUF->vhl = 0x45;
+  BUF->len[0] = (UIP_TCPIP_HLEN + len) >> 8;
+  BUF->len[1] = (UIP_TCPIP_HLEN + len) & 0xff;
+  BUF->ttl = UIP_TTL;
+  BUF->proto = UIP_PROTO_TCP;
+  uip_ipaddr_copy(BUF->srcipaddr, remote_addr);
+  uip_ipaddr_copy(BUF->destipaddr, local_addr);
+  BUF->srcport = HTONS(REMOTE_PORT);
+  BUF->destport = HTONS(LOCAL_PORT);
+  memcpy(BUF->seqno, conn->rcv_nxt, 4);
+  memcpy(BUF->ackno, conn->snd_nxt, 4);
+  BUF->tcpoffset = 5 << 4;
+  BUF->flags = flags;
+  BUF->wnd[0] = 0x10;
+  uip_len = UIP_TCPIP_HLEN + len;
+  uip_input();
+}
+
+#define CHECK(c) do { if (!(c)) { \
+    printf("FAIL: line %d: %s\n", __LINE__, #c); return 1; } } while (0)
+
+int main(void)
+{
+  struct uip_conn *conn = &uip_conns[0];
+
+  uip_init();
+  uip_twheel_init();
+  uip_ipaddr(local_addr, 10, 0, 0, 1);
+  uip_ipaddr(remote_addr, 10, 0, 0, 2);
+  uip_sethostaddr(local_addr);
+#if UIP_CHECKSUM_OFFLOAD
+  uip_rx_chksum_ok = UIP_RX_IPCHKSUM_OK | UIP_RX_L4CHKSUM_OK;
+#endif
+  uip_listen(HTONS(LOCAL_PORT));
+
+  // A reset drops the ACK the connection was holding back
+  open_conn(conn);
+  deliver(conn, TCP_ACK, DATA_LEN);
+  CHECK(conn->delack_bytes == DATA_LEN);
+  CHECK(uip_twheel_armed(&conn->delack_tmr));
+  deliver(conn, TCP_RST, 0);
+  CHECK(conn->tcpstateflags == UIP_CLOSED);
+  CHECK(conn->delack_bytes == 0);
+  CHECK(!uip_twheel_armed(&conn->delack_tmr));
+
+  // A new connection in a slot that was left with an ACK held back
+  // starts without it
+  open_conn(conn);
+  deliver(conn, TCP_ACK, DATA_LEN);
+  CHECK(conn->delack_bytes == DATA_LEN);
+  conn->tcpstateflags = UIP_CLOSED;
+  deliver(conn, TCP_SYN, 0);
+  CHECK(conn->tcpstateflags == UIP_SYN_RCVD);
+  CHECK(conn->delack_bytes == 0);
+  CHECK(!uip_twheel_armed(&conn->delack_tmr));
+
+  printf("test_delack: pass\n");
+  return 0;
+}